@@ -1,16 +1,16 @@
 #include "base64.h"
 #include <iostream>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 static const std::string base64_chars = 
              "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
              "abcdefghijklmnopqrstuvwxyz"
              "0123456789+/";
 
-
-static inline bool is_base64(unsigned char c) {
-  return (isalnum(c) || (c == '+') || (c == '/'));
-}
-
 std::string base64_encode(unsigned char const* buf, unsigned int bufLen) {
   std::string ret;
   int i = 0;
@@ -52,84 +52,291 @@ std::string base64_encode(unsigned char const* buf, unsigned int bufLen) {
   return ret;
 }
 
-std::vector<unsigned char> base64_decode(std::string const& encoded_string) {
-  int in_len = encoded_string.size();
-  int i = 0;
-  int j = 0;
-  int in_ = 0;
-  unsigned char char_array_4[4], char_array_3[3];
-  std::vector<unsigned char> ret;
+// Decoding table: value of each base64 symbol, 0xFF for every other byte
+// (including '=' which terminates the decoding).
+static const unsigned char base64_table[256] = {
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255, 255,  63,
+   52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255, 255, 255, 255,
+  255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+   15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255, 255,
+  255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+   41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255
+};
 
-  while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-    char_array_4[i++] = encoded_string[in_]; in_++;
-    if (i ==4) {
-      for (i = 0; i <4; i++)
-        char_array_4[i] = base64_chars.find(char_array_4[i]);
+static const unsigned char base64_invalid = 0xFF;
 
+// Scalar kernel, also used to finish the input left over by the SIMD kernels.
+// Whole quadruplets are decoded through the table, the last partial group
+// follows the original semantics (i symbols give i-1 bytes).
+static unsigned int decode_scalar(const unsigned char * in, unsigned int len,
+                                  unsigned char * out, unsigned int capacity)
+{
+  unsigned int o = 0;
+  while (len >= 4 && capacity - o >= 3) {
+    unsigned int a = base64_table[in[0]];
+    unsigned int b = base64_table[in[1]];
+    unsigned int c = base64_table[in[2]];
+    unsigned int d = base64_table[in[3]];
+    if ((a | b | c | d) > 63) break; // '=' or invalid symbol
+
+    unsigned int v = (a << 18) | (b << 12) | (c << 6) | d;
+    out[o]     = (unsigned char)(v >> 16);
+    out[o + 1] = (unsigned char)(v >> 8);
+    out[o + 2] = (unsigned char)v;
+    in += 4; len -= 4; o += 3;
+  }
+
+  unsigned char char_array_4[4];
+  int i = 0;
+  while (len-- && base64_table[*in] != base64_invalid) {
+    char_array_4[i++] = base64_table[*in++];
+    if (i == 4) {
+      unsigned char char_array_3[3];
       char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
       char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
       char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-      for (i = 0; (i < 3); i++)
-          ret.push_back(char_array_3[i]);
+      for (i = 0; i < 3 && o < capacity; i++) out[o++] = char_array_3[i];
       i = 0;
     }
   }
 
-  if (i) {
-    for (j = i; j <4; j++)
-      char_array_4[j] = 0;
-
-    for (j = 0; j <4; j++)
-      char_array_4[j] = base64_chars.find(char_array_4[j]);
-
+  if (i > 1) {
+    for (int j = i; j < 4; j++) char_array_4[j] = 0;
+    unsigned char char_array_3[3];
     char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
     char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-    char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-    for (j = 0; (j < i - 1); j++) ret.push_back(char_array_3[j]);
+    for (int j = 0; j < i - 1 && o < capacity; j++) out[o++] = char_array_3[j];
   }
 
-  return ret;
+  return o;
 }
 
-std::vector<unsigned char> base64_decode_array(const char * encoded_string, unsigned int len) {
-  int in_len = len;
-  int i = 0;
-  int j = 0;
-  int in_ = 0;
-  unsigned char char_array_4[4], char_array_3[3];
-  std::vector<unsigned char> ret;
+#ifdef BASE64_X86_KERNELS
+// SIMD kernels (W. Mula and D. Lemire, "Faster Base64 Encoding and Decoding
+// using AVX2 Instructions"). Symbols are translated with nibble lookups and
+// validated in the same pass; a block containing '=' or an invalid symbol is
+// left to the scalar kernel. Each store writes a full register, so the loops
+// stop while there is not enough room left in out. Blocks are loaded before
+// being stored, which keeps in-place decoding safe.
 
-  while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-    char_array_4[i++] = encoded_string[in_]; in_++;
-    if (i ==4) {
-      for (i = 0; i <4; i++)
-        char_array_4[i] = base64_chars.find(char_array_4[i]);
+__attribute__((target("sse4.1")))
+static void decode_sse41(const unsigned char * in, unsigned int len,
+                         unsigned char * out, unsigned int capacity,
+                         unsigned int & i, unsigned int & o)
+{
+  const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0,  0,  0, 0,   0,   0,   0,   0);
+  const __m128i mask_2F = _mm_set1_epi8(0x2f);
+  const __m128i pack = _mm_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
 
-      char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-      char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-      char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+  while (len - i >= 16 && capacity - o >= 16) {
+    __m128i str = _mm_loadu_si128((const __m128i *)(in + i));
 
-      for (i = 0; (i < 3); i++)
-          ret.push_back(char_array_3[i]);
-      i = 0;
-    }
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2F);
+    const __m128i lo_nibbles = _mm_and_si128(str, mask_2F);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm_testz_si128(lo, hi)) break;
+
+    const __m128i eq_2F = _mm_cmpeq_epi8(str, mask_2F);
+    const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2F, hi_nibbles));
+    str = _mm_add_epi8(str, roll);
+
+    const __m128i merge_ab_and_bc = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+    __m128i packed = _mm_madd_epi16(merge_ab_and_bc, _mm_set1_epi32(0x00011000));
+    packed = _mm_shuffle_epi8(packed, pack);
+    _mm_storeu_si128((__m128i *)(out + o), packed);
+
+    i += 16;
+    o += 12;
   }
+}
 
-  if (i) {
-    for (j = i; j <4; j++)
-      char_array_4[j] = 0;
+__attribute__((target("avx2")))
+static void decode_avx2(const unsigned char * in, unsigned int len,
+                        unsigned char * out, unsigned int capacity,
+                        unsigned int & i, unsigned int & o)
+{
+  const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0,  0,  0, 0,   0,   0,   0,   0,
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0,  0,  0, 0,   0,   0,   0,   0);
+  const __m256i mask_2F = _mm256_set1_epi8(0x2f);
+  const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
 
-    for (j = 0; j <4; j++)
-      char_array_4[j] = base64_chars.find(char_array_4[j]);
+  while (len - i >= 32 && capacity - o >= 32) {
+    __m256i str = _mm256_loadu_si256((const __m256i *)(in + i));
 
-    char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-    char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-    char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+    const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2F);
+    const __m256i lo_nibbles = _mm256_and_si256(str, mask_2F);
+    const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm256_testz_si256(lo, hi)) break;
+
+    const __m256i eq_2F = _mm256_cmpeq_epi8(str, mask_2F);
+    const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2F, hi_nibbles));
+    str = _mm256_add_epi8(str, roll);
+
+    const __m256i merge_ab_and_bc = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+    __m256i packed = _mm256_madd_epi16(merge_ab_and_bc, _mm256_set1_epi32(0x00011000));
+    packed = _mm256_shuffle_epi8(packed, pack);
+    packed = _mm256_permutevar8x32_epi32(packed, lanes);
+    _mm256_storeu_si256((__m256i *)(out + o), packed);
 
-    for (j = 0; (j < i - 1); j++) ret.push_back(char_array_3[j]);
+    i += 32;
+    o += 24;
   }
+}
+#endif
+
+bool base64_kernel_supported(base64_kernel kernel)
+{
+  switch (kernel) {
+    case BASE64_KERNEL_AUTO:
+    case BASE64_KERNEL_SCALAR:
+      return true;
+#ifdef BASE64_X86_KERNELS
+    case BASE64_KERNEL_SSE41:
+      return __builtin_cpu_supports("sse4.1");
+    case BASE64_KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+const char * base64_kernel_name(base64_kernel kernel)
+{
+  switch (kernel) {
+    case BASE64_KERNEL_AUTO:   return "auto";
+    case BASE64_KERNEL_SCALAR: return "scalar";
+    case BASE64_KERNEL_SSE41:  return "sse4.1";
+    case BASE64_KERNEL_AVX2:   return "avx2";
+  }
+  return "unknown";
+}
+
+static base64_kernel best_kernel()
+{
+  static const base64_kernel best =
+      base64_kernel_supported(BASE64_KERNEL_AVX2)  ? BASE64_KERNEL_AVX2 :
+      base64_kernel_supported(BASE64_KERNEL_SSE41) ? BASE64_KERNEL_SSE41 :
+                                                     BASE64_KERNEL_SCALAR;
+  return best;
+}
 
+unsigned int base64_decoded_size(unsigned int len)
+{
+  return (len / 4) * 3 + 2;
+}
+
+unsigned int base64_decode_into(const char * encoded_string, unsigned int len,
+                                unsigned char * out, unsigned int capacity,
+                                base64_kernel kernel)
+{
+  const unsigned char * in = reinterpret_cast<const unsigned char *>(encoded_string);
+  unsigned int i = 0;
+  unsigned int o = 0;
+
+  if (kernel == BASE64_KERNEL_AUTO || !base64_kernel_supported(kernel))
+    kernel = best_kernel();
+
+#ifdef BASE64_X86_KERNELS
+  if (kernel == BASE64_KERNEL_AVX2)
+    decode_avx2(in, len, out, capacity, i, o);
+  if (kernel == BASE64_KERNEL_AVX2 || kernel == BASE64_KERNEL_SSE41)
+    decode_sse41(in, len, out, capacity, i, o);
+#endif
+
+  return o + decode_scalar(in + i, len - i, out + o, capacity - o);
+}
+
+void base64_stream_init(base64_stream * state)
+{
+  state->carried = 0;
+  state->done = false;
+}
+
+unsigned int base64_stream_decode(base64_stream * state, const char * chunk, unsigned int len,
+                                  unsigned char * out, unsigned int capacity)
+{
+  unsigned int o = 0;
+
+  // complete the quadruplet started by the previous chunk
+  while (!state->done && state->carried > 0 && state->carried < 4 && len > 0) {
+    state->carry[state->carried++] = *chunk++;
+    len--;
+  }
+  if (!state->done && state->carried == 4) {
+    o = base64_decode_into(state->carry, 4, out, capacity);
+    state->carried = 0;
+    state->done = (o < 3);
+  }
+  if (state->done || len == 0) return o;
+
+  // whole quadruplets, a partial result means the end of the data was met
+  unsigned int whole = len & ~3u;
+  unsigned int n = base64_decode_into(chunk, whole, out + o, capacity - o);
+  o += n;
+  if (n < (whole / 4) * 3) {
+    state->done = true;
+    return o;
+  }
+
+  for (unsigned int i = whole; i < len; i++)
+    state->carry[state->carried++] = chunk[i];
+  return o;
+}
+
+unsigned int base64_stream_finish(base64_stream * state, unsigned char * out, unsigned int capacity)
+{
+  unsigned int o = 0;
+  if (!state->done && state->carried > 0)
+    o = base64_decode_into(state->carry, state->carried, out, capacity);
+  state->carried = 0;
+  state->done = true;
+  return o;
+}
+
+std::vector<unsigned char> base64_decode(std::string const& encoded_string) {
+  return base64_decode_array(encoded_string.data(), encoded_string.size());
+}
+
+std::vector<unsigned char> base64_decode_array(const char * encoded_string, unsigned int len) {
+  std::vector<unsigned char> ret(base64_decoded_size(len));
+  ret.resize(base64_decode_into(encoded_string, len, ret.data(), ret.size()));
   return ret;
-}
\ No newline at end of file
+}
@@ -4,8 +4,49 @@
 #include <vector>
 #include <string>
 
+// Decoding kernels. BASE64_KERNEL_AUTO picks the fastest one supported by the
+// running CPU (checked once at runtime), the others force a given kernel.
+enum base64_kernel {
+  BASE64_KERNEL_AUTO = 0,
+  BASE64_KERNEL_SCALAR,
+  BASE64_KERNEL_SSE41,
+  BASE64_KERNEL_AVX2
+};
+
 std::string base64_encode(unsigned char const* buf, unsigned int bufLen);
 std::vector<unsigned char> base64_decode(std::string const&);
 std::vector<unsigned char> base64_decode_array(const char * encoded_string, unsigned int len);
 
-#endif
\ No newline at end of file
+// Upper bound of the number of bytes produced by decoding len characters.
+unsigned int base64_decoded_size(unsigned int len);
+
+// Decodes encoded_string into the preallocated buffer out (capacity bytes) and
+// returns the number of bytes written. Decoding stops at the first '=' or
+// non-base64 character, exactly like base64_decode_array. out may point to
+// encoded_string itself (in-place decoding).
+unsigned int base64_decode_into(const char * encoded_string, unsigned int len,
+                                unsigned char * out, unsigned int capacity,
+                                base64_kernel kernel = BASE64_KERNEL_AUTO);
+
+// Incremental decoding of a stream received in chunks of any size. Symbols of
+// an incomplete quadruplet are carried over to the next chunk; the output is
+// the same as decoding the concatenated chunks at once. A chunk may be
+// decoded in place only if out trails it by at least 3 bytes
+// (out + 3 <= chunk): the quadruplet completed with the first symbols of the
+// chunk is written to out before the rest of the chunk is read.
+struct base64_stream {
+  char carry[4];
+  unsigned int carried;
+  bool done; // '=' or an invalid symbol was met, the rest is ignored
+};
+
+void base64_stream_init(base64_stream * state);
+unsigned int base64_stream_decode(base64_stream * state, const char * chunk, unsigned int len,
+                                  unsigned char * out, unsigned int capacity);
+// flushes the last incomplete quadruplet
+unsigned int base64_stream_finish(base64_stream * state, unsigned char * out, unsigned int capacity);
+
+bool base64_kernel_supported(base64_kernel kernel);
+const char * base64_kernel_name(base64_kernel kernel);
+
+#endif
@@ -0,0 +1,198 @@
+#include "vpJpegStreamDecoder.h"
+
+#ifdef WITH_JPEG
+
+#include <algorithm>
+
+vpJpegStreamDecoder::vpJpegStreamDecoder()
+    : created(false), grey(true), state(FAILED), current(HEADER),
+      data(NULL), size(0), consumed(0), skipPending(0), last(false), truncated(false),
+      output(NULL), stride(0), width(0), height(0)
+{
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    jerr.pub.output_message = outputMessage;
+    if (setjmp(jerr.jump)) {
+        return;
+    }
+    jpeg_create_decompress(&cinfo);
+    created = true;
+
+    source.decoder = this;
+    source.pub.init_source = initSource;
+    source.pub.fill_input_buffer = fillInputBuffer;
+    source.pub.skip_input_data = skipInputData;
+    source.pub.resync_to_restart = jpeg_resync_to_restart;
+    source.pub.term_source = termSource;
+    source.pub.next_input_byte = NULL;
+    source.pub.bytes_in_buffer = 0;
+    cinfo.src = &source.pub;
+}
+
+vpJpegStreamDecoder::~vpJpegStreamDecoder()
+{
+    if (created) jpeg_destroy_decompress(&cinfo);
+}
+
+void vpJpegStreamDecoder::reset(bool grey, Allocator allocator)
+{
+    if (created) jpeg_abort_decompress(&cinfo); // keeps the allocated decoder for the next image
+
+    this->grey = grey;
+    this->allocator = allocator;
+    state = created ? NEED_MORE : FAILED;
+    current = HEADER;
+    data = NULL;
+    size = 0;
+    consumed = 0;
+    skipPending = 0;
+    last = false;
+    truncated = false;
+    jerr.pub.num_warnings = 0;
+    output = NULL;
+    stride = 0;
+    width = 0;
+    height = 0;
+    source.pub.next_input_byte = NULL;
+    source.pub.bytes_in_buffer = 0;
+}
+
+vpJpegStreamDecoder::State vpJpegStreamDecoder::feed(const unsigned char * data, unsigned int size, bool last)
+{
+    if (state != NEED_MORE) return state;
+
+    // libjpeg resumes from the last byte it committed, all the previous data is kept in the buffer
+    this->data = data;
+    this->size = size;
+    this->last = last;
+    unsigned long skip = std::min<unsigned long>(skipPending, size - consumed);
+    consumed += skip;
+    skipPending -= skip;
+    source.pub.next_input_byte = data + consumed;
+    source.pub.bytes_in_buffer = size - consumed;
+
+    if (setjmp(jerr.jump)) {
+        jpeg_abort_decompress(&cinfo);
+        state = FAILED;
+        return state;
+    }
+
+    // a truncated or corrupt image decodes to the end, with grey blocks
+    if (this->step()) state = (truncated || jerr.pub.num_warnings > 0) ? FAILED : DONE;
+    else if (last) state = FAILED;
+
+    if (state == NEED_MORE) consumed = source.pub.next_input_byte - data;
+    return state;
+}
+
+const bool vpJpegStreamDecoder::step()
+{
+    for (;;) {
+        switch (current) {
+        case HEADER:
+            if (jpeg_read_header(&cinfo, TRUE) == JPEG_SUSPENDED) return false;
+            #ifdef JCS_EXTENSIONS
+                cinfo.out_color_space = grey ? JCS_GRAYSCALE : JCS_EXT_BGR;
+            #else
+                cinfo.out_color_space = grey ? JCS_GRAYSCALE : JCS_RGB;
+            #endif
+            current = START;
+            break;
+
+        case START:
+            if (!jpeg_start_decompress(&cinfo)) return false;
+            width = cinfo.output_width;
+            height = cinfo.output_height;
+            output = allocator ? allocator(width, height, cinfo.output_components, stride) : NULL;
+            if (output == NULL) {
+                jpeg_abort_decompress(&cinfo);
+                state = FAILED;
+                return false;
+            }
+            current = SCANLINES;
+            break;
+
+        case SCANLINES:
+            while (cinfo.output_scanline < cinfo.output_height) {
+                JSAMPROW rows[8];
+                unsigned int first = cinfo.output_scanline;
+                unsigned int count = std::min(8u, cinfo.output_height - first);
+                for (unsigned int r = 0; r < count; r++)
+                    rows[r] = output + (size_t)(first + r) * stride;
+                if (jpeg_read_scanlines(&cinfo, rows, count) == 0) return false;
+
+                #ifndef JCS_EXTENSIONS
+                if (!grey) {
+                    for (unsigned int r = first; r < cinfo.output_scanline; r++) {
+                        unsigned char * p = output + (size_t)r * stride;
+                        for (unsigned int c = 0; c < width; c++, p += 3) std::swap(p[0], p[2]);
+                    }
+                }
+                #endif
+            }
+            current = FINISH;
+            break;
+
+        case FINISH:
+            if (!jpeg_finish_decompress(&cinfo)) return false;
+            return true;
+        }
+    }
+}
+
+// =============================================================================
+// LIBJPEG CALLBACKS
+// =============================================================================
+
+void vpJpegStreamDecoder::errorExit(j_common_ptr cinfo)
+{
+    ErrorManager * err = (ErrorManager *)cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+void vpJpegStreamDecoder::outputMessage(j_common_ptr)
+{
+    // warnings (corrupt or premature end of data) are counted by libjpeg and
+    // reported through the state
+}
+
+void vpJpegStreamDecoder::initSource(j_decompress_ptr)
+{
+}
+
+boolean vpJpegStreamDecoder::fillInputBuffer(j_decompress_ptr cinfo)
+{
+    vpJpegStreamDecoder * decoder = ((SourceManager *)cinfo->src)->decoder;
+    if (!decoder->last) return FALSE; // suspend until more data is received
+
+    // truncated image: terminate it so that libjpeg can complete the decoding,
+    // which then fails
+    decoder->truncated = true;
+    static const JOCTET eoi[2] = {0xFF, JPEG_EOI};
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+void vpJpegStreamDecoder::skipInputData(j_decompress_ptr cinfo, long count)
+{
+    if (count <= 0) return;
+    jpeg_source_mgr * src = cinfo->src;
+    if ((size_t)count <= src->bytes_in_buffer) {
+        src->next_input_byte += count;
+        src->bytes_in_buffer -= count;
+    }
+    else {
+        // the rest is skipped when it arrives
+        vpJpegStreamDecoder * decoder = ((SourceManager *)src)->decoder;
+        decoder->skipPending += count - src->bytes_in_buffer;
+        src->next_input_byte += src->bytes_in_buffer;
+        src->bytes_in_buffer = 0;
+    }
+}
+
+void vpJpegStreamDecoder::termSource(j_decompress_ptr)
+{
+}
+
+#endif // WITH_JPEG
@@ -0,0 +1,89 @@
+#ifndef VP_JPEG_STREAM_DECODER_H
+#define VP_JPEG_STREAM_DECODER_H
+
+#ifdef WITH_JPEG
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <functional>
+
+#include <jpeglib.h>
+
+// Incremental JPEG decoder (libjpeg suspending data source).
+//
+// The compressed image grows at the beginning of a buffer while it is being
+// received; feed() is called with the whole buffer each time new bytes are
+// appended and decodes as many scanlines as the available data allows. The
+// output is written to the memory returned by the allocator once the header
+// has been parsed, so the caller can decode straight into its own image.
+class vpJpegStreamDecoder
+{
+    public:
+        enum State { NEED_MORE, DONE, FAILED };
+
+        // returns the destination of a width x height x channels image and its row stride
+        typedef std::function<unsigned char * (unsigned int width, unsigned int height,
+                                               unsigned int channels, unsigned int & stride)> Allocator;
+
+        vpJpegStreamDecoder();
+        ~vpJpegStreamDecoder();
+
+        // starts a new image, grey (1 channel) or BGR (3 channels)
+        void reset(bool grey, Allocator allocator);
+        // data[0, size) is the compressed image received so far, last when
+        // complete. A truncated or corrupt image is FAILED, its output partly
+        // written.
+        State feed(const unsigned char * data, unsigned int size, bool last);
+
+        State getState() const { return state; }
+        unsigned int getWidth() const { return width; }
+        unsigned int getHeight() const { return height; }
+
+    private:
+        enum Step { HEADER, START, SCANLINES, FINISH };
+
+        struct ErrorManager
+        {
+            jpeg_error_mgr pub;
+            jmp_buf jump;
+        };
+
+        struct SourceManager
+        {
+            jpeg_source_mgr pub;
+            vpJpegStreamDecoder * decoder;
+        };
+
+        static void errorExit(j_common_ptr);
+        static void outputMessage(j_common_ptr);
+        static void initSource(j_decompress_ptr);
+        static boolean fillInputBuffer(j_decompress_ptr);
+        static void skipInputData(j_decompress_ptr, long);
+        static void termSource(j_decompress_ptr);
+
+        const bool step();
+
+        jpeg_decompress_struct cinfo;
+        ErrorManager jerr;
+        SourceManager source;
+        bool created;
+
+        Allocator allocator;
+        bool grey;
+        State state;
+        Step current;
+        const unsigned char * data;
+        unsigned int size;
+        unsigned int consumed; // bytes already handed over to libjpeg
+        unsigned long skipPending;
+        bool last;
+        bool truncated; // ended before its EOI marker
+
+        unsigned char * output;
+        unsigned int stride;
+        unsigned int width;
+        unsigned int height;
+};
+
+#endif // WITH_JPEG
+#endif // VP_JPEG_STREAM_DECODER_H
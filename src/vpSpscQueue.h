@@ -0,0 +1,49 @@
+#ifndef VP_SPSC_QUEUE_H
+#define VP_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Lock-free single producer / single consumer queue of N slots.
+//
+// The producer fills writeSlot() in place and pushes it, the consumer reads
+// front() in place and pops it. Nothing is allocated or copied by the queue;
+// a full queue returns no write slot instead of waiting.
+template <typename T, unsigned int N>
+class vpSpscQueue
+{
+    public:
+        vpSpscQueue() : head(0), tail(0) {}
+
+        // producer side, NULL when the queue is full
+        T * writeSlot()
+        {
+            size_t position = head.load(std::memory_order_relaxed);
+            if (position - tail.load(std::memory_order_acquire) == N) return NULL;
+            return &slots[position % N];
+        }
+        void push(){ head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+        // consumer side, NULL when the queue is empty
+        T * front()
+        {
+            size_t position = tail.load(std::memory_order_relaxed);
+            if (position == head.load(std::memory_order_acquire)) return NULL;
+            return &slots[position % N];
+        }
+        void pop(){ tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    private:
+        // head and tail a cache line apart from each other and from the
+        // rest: padded rather than alignas(64), which new does not honour
+        // before C++17 and the queue is a member of heap allocated objects
+        static const size_t CACHE_LINE = 64;
+        T slots[N];
+        char slotsPadding[CACHE_LINE];
+        std::atomic<size_t> head; // next slot to write, owned by the producer
+        char headPadding[CACHE_LINE - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> tail; // next slot to read, owned by the consumer
+        char tailPadding[CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+#endif // VP_SPSC_QUEUE_H
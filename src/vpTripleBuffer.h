@@ -0,0 +1,41 @@
+#ifndef VP_TRIPLE_BUFFER_H
+#define VP_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free single writer / single reader triple buffer.
+//
+// The writer fills writeBuffer() and publishes it, the reader swaps in the
+// latest published slot with update(). Neither side ever waits: the writer
+// overwrites frames the reader did not take, and the reader keeps its current
+// slot until something newer is published.
+template <typename T>
+class vpTripleBuffer
+{
+    public:
+        vpTripleBuffer() : back(0), front(1), middle(2) {}
+
+        // writer side
+        T & writeBuffer(){ return slots[back]; }
+        void publish(){ back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX; }
+
+        // reader side, returns false when nothing was published since the last update
+        const bool update()
+        {
+            if (!(middle.load(std::memory_order_acquire) & FRESH)) return false;
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+        T & readBuffer(){ return slots[front]; }
+        const T & readBuffer() const { return slots[front]; }
+
+    private:
+        enum { INDEX = 3, FRESH = 4 };
+
+        T slots[3];
+        unsigned int back;  // owned by the writer
+        unsigned int front; // owned by the reader
+        std::atomic<unsigned int> middle; // last published slot, FRESH until taken
+};
+
+#endif // VP_TRIPLE_BUFFER_H
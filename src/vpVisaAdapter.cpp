@@ -10,29 +10,29 @@ std::string& rtrim(std::string& str, const std::string& chars = "\t\n\v\f\r_ ")
     return str;
 }
 
-template<typename Out>
-void split(const std::string &s, char delim, Out result) {
-    std::stringstream ss(s);
-    std::string item;
-    while (std::getline(ss, item, delim)) {
-        *(result++) = item;
-    }
-}
-
-std::vector<std::string> split(const std::string &s, char delim) {
-    std::vector<std::string> elems;
-    split(s, delim, std::back_inserter(elems));
-    return elems;
-}
-
 // =============================================================================
 // FUNCTIONS
 // =============================================================================
 
 vpVisaAdapter::vpVisaAdapter()
-    : connected(false)
+    : receiving(false), nextSequence(0), demuxBuffer(65536), timeout(1000), retries(2),
+      statsDumpPeriod(0), nextStatsDump(0),
+      encodedSize(0), imageWidth(640), imageHeight(480), streamingDecode(false),
+      deltaTransport(false), deltaFrame(0),
+    #if defined(WITH_OPENCV) && defined(WITH_VISP)
+      grabberAdapter(NULL), grabberRunning(false), grabbedSequence(0),
+      lastSequence(0), droppedFrames(0), duplicatedFrames(0),
+    #endif
+      velocityRunning(false), kinematicsCheckPeriod(0), kinematicsTolerance(0), kinematicsRequests(0),
+      framePoolSize(4), port(0), connected(false), binaryProtocol(false), tickSupported(true),
+      roiSupported(true)
 {
-
+    memset(&frameStats, 0, sizeof(frameStats));
+    memset(&kinematicsStats, 0, sizeof(kinematicsStats));
+    pendingReplies.reserve(16);
+    velocityInFlight.reserve(VELOCITY_WINDOW);
+    ioStats.requests = ioStats.retries = ioStats.timeouts = ioStats.staleReplies = 0;
+    streamStats.queued = streamStats.sent = streamStats.coalesced = streamStats.failed = streamStats.rejected = 0;
 }
 
 vpVisaAdapter::~vpVisaAdapter()
@@ -47,6 +47,8 @@ bool vpVisaAdapter::connect(const char* host, const unsigned int port)
         WSAStartup(MAKEWORD(2,0), &WSAData);
     #endif
 
+    this->host = host;
+    this->port = port;
     server_socket.sin_addr.s_addr = inet_addr(host);
     server_socket.sin_family	  = AF_INET;
     server_socket.sin_port		  = htons(port);
@@ -54,6 +56,20 @@ bool vpVisaAdapter::connect(const char* host, const unsigned int port)
     sock = socket(AF_INET, SOCK_DGRAM , IPPROTO_UDP);
 	//sock = socket(AF_INET, SOCK_STREAM, 0);
 
+    // room for a whole image payload arriving as a burst of datagrams
+    int receiveBuffer = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&receiveBuffer, sizeof(receiveBuffer));
+
+    // non-blocking: every wait is a poll bounded by the deadline of the call
+    #ifdef _WIN32
+        u_long nonBlocking = 1;
+        ioctlsocket(sock, FIONBIO, &nonBlocking);
+    #else
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    #endif
+    ioStats.requests = ioStats.retries = ioStats.timeouts = ioStats.staleReplies = 0;
+    this->resetStats();
+
     #ifdef _WIN32
         connected = connected = (::connect(sock, (SOCKADDR*)&sin, sizeof(sin)) != SOCKET_ERROR);
     #elif __linux__ || __APPLE__
@@ -64,15 +80,30 @@ bool vpVisaAdapter::connect(const char* host, const unsigned int port)
 
     std::vector<double> K;
     this->getCalibMatrix(K);
-    int width = K[6]*2;
-    int height = K[7]*2;
-    this->bufferImage = new unsigned char[width*height+2];
+    if (K.size() >= 8){
+        imageWidth = K[6]*2;
+        imageHeight = K[7]*2;
+    }
+    this->probeTick();
+    if (deltaTransport) this->setDeltaTransport(true);
+    #if defined(WITH_OPENCV) && defined(WITH_VISP)
+        this->probeRoi();
+    #endif
+
+    // room for a grey frame, or a colour image encoded without compression
+    framePool = std::make_shared<vpVisaFramePool>(framePoolSize, imageWidth * imageHeight * 3 + 65536);
 
     return connected;
 }
 
 void vpVisaAdapter::disconnect()
 {
+    this->stopVelocityStream();
+    this->stopRecording();
+    #if defined(WITH_OPENCV) && defined(WITH_VISP)
+        this->stopGrabber();
+    #endif
+
     if (this->connected){
         //dtor
         #ifdef _WIN32
@@ -86,21 +117,516 @@ void vpVisaAdapter::disconnect()
     }
 }
 
-const bool vpVisaAdapter::sendCmd(std::string cmd, std::vector<double> args)
+void vpVisaAdapter::setTimeout(unsigned int ms, unsigned int retries)
+{
+    this->timeout = std::chrono::milliseconds(ms);
+    this->retries = std::min(retries, 8u);
+}
+
+const vpVisaIoStats vpVisaAdapter::getIoStats() const
+{
+    vpVisaIoStats stats;
+    stats.requests = ioStats.requests;
+    stats.retries = ioStats.retries;
+    stats.timeouts = ioStats.timeouts;
+    stats.staleReplies = ioStats.staleReplies;
+    return stats;
+}
+
+// =============================================================================
+// LATENCY STATISTICS
+// =============================================================================
+
+thread_local int vpVisaAdapter::callDepth = 0;
+thread_local vpVisaCall vpVisaAdapter::currentCall = VISA_CALL_COMMAND;
+
+static long long nanoseconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+vpVisaAdapter::CallTimer::CallTimer(vpVisaAdapter * adapter, vpVisaCall call)
+    : adapter(adapter), outermost(callDepth++ == 0)
+{
+    if (!outermost) return;
+    currentCall = call;
+    start = std::chrono::steady_clock::now();
+}
+
+vpVisaAdapter::CallTimer::~CallTimer()
+{
+    callDepth--;
+    if (!outermost) return;
+    auto end = std::chrono::steady_clock::now();
+    adapter->latency[currentCall][VISA_PHASE_CALL].record(nanoseconds(end - start));
+
+    long long period = adapter->statsDumpPeriod.load(std::memory_order_relaxed);
+    if (period == 0) return;
+    long long now = nanoseconds(end.time_since_epoch());
+    long long next = adapter->nextStatsDump.load(std::memory_order_relaxed);
+    if (now >= next && adapter->nextStatsDump.compare_exchange_strong(next, now + period)){
+        // through the log, whatever its level
+        std::ostringstream table;
+        adapter->printStats(table);
+        std::istringstream lines(table.str());
+        std::string line;
+        while (std::getline(lines, line)) vpVisaLog::write(VISA_LOG_INFO, "%s", line.c_str());
+    }
+}
+
+void vpVisaAdapter::recordPhase(vpVisaPhase phase, std::chrono::steady_clock::time_point start)
+{
+    this->recordPhase(phase, std::chrono::steady_clock::now() - start);
+}
+
+void vpVisaAdapter::recordPhase(vpVisaPhase phase, std::chrono::steady_clock::duration duration)
+{
+    if (callDepth > 0) latency[currentCall][phase].record(nanoseconds(duration));
+}
+
+const vpVisaLatencyStats vpVisaAdapter::getStats() const
+{
+    vpVisaLatencyStats stats;
+    for (int call = 0; call < VISA_CALL_COUNT; call++){
+        for (int phase = 0; phase < VISA_PHASE_COUNT; phase++){
+            stats.latency[call][phase] = latency[call][phase].summarize();
+        }
+    }
+    return stats;
+}
+
+void vpVisaAdapter::resetStats()
+{
+    for (int call = 0; call < VISA_CALL_COUNT; call++){
+        for (int phase = 0; phase < VISA_PHASE_COUNT; phase++) latency[call][phase].reset();
+    }
+}
+
+void vpVisaAdapter::printStats(std::ostream & out) const
 {
+    static const char * calls[] = { "command", "query", "image", "imageBW" };
+    static const char * phases[] = { "send", "wait", "receive", "base64", "decode", "convert", "call" };
+
+    std::ostringstream text; // one write, not mixed with other threads
+    text << std::fixed << std::setprecision(1)
+         << "VISA latency (us)      count      mean       p50       p90       p99       max" << std::endl;
+    for (int call = 0; call < VISA_CALL_COUNT; call++){
+        for (int phase = 0; phase < VISA_PHASE_COUNT; phase++){
+            vpVisaLatency l = latency[call][phase].summarize();
+            if (l.count == 0) continue;
+            std::string name = std::string(calls[call]) + "/" + phases[phase];
+            text << "  " << std::left << std::setw(16) << name << std::right << std::setw(9) << l.count
+                 << std::setw(10) << l.mean << std::setw(10) << l.p50 << std::setw(10) << l.p90
+                 << std::setw(10) << l.p99 << std::setw(10) << l.max << std::endl;
+        }
+    }
+    out << text.str() << std::flush;
+}
+
+void vpVisaAdapter::setStatsDump(unsigned int periodMs)
+{
+    long long period = periodMs * 1000000LL;
+    nextStatsDump = nanoseconds(std::chrono::steady_clock::now().time_since_epoch()) + period;
+    statsDumpPeriod = period;
+}
+
+// =============================================================================
+// RECORDING
+// =============================================================================
+
+const bool vpVisaAdapter::startRecording(const std::string & path)
+{
+    if (!connected) return false;
+    // an encoded image is never larger than the raw colour one
+    return recorder.open(path, imageWidth * imageHeight * 3 + 65536);
+}
+
+void vpVisaAdapter::stopRecording()
+{
+    recorder.close();
+}
+
+const bool vpVisaAdapter::setBinaryProtocol(bool enable)
+{
+    if (!enable){
+        binaryProtocol = false; // text commands are always accepted
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(textMutex);
+        this->beginText();
+        const char request[] = "SETPROTOCOL,BINARY";
+        ::send(sock, request, sizeof(request)-1, 0);
+
+        // a simulator without binary support may not answer at all
+        #ifdef _WIN32
+            WSAPOLLFD fds = { sock, POLLIN, 0 };
+            bool answered = (WSAPoll(&fds, 1, PROBE_TIMEOUT) > 0);
+        #else
+            struct pollfd fds = { sock, POLLIN, 0 };
+            bool answered = (::poll(&fds, 1, PROBE_TIMEOUT) > 0);
+        #endif
+
+        char bufferResponse[500];
+        binaryProtocol = false;
+        if (answered){
+            auto n = ::recv(sock, bufferResponse, sizeof(bufferResponse)-1, 0);
+            binaryProtocol = (n >= 2 && strncmp(bufferResponse, "OK", 2) == 0);
+        }
+    }
+    if (!binaryProtocol){
+        VISA_LOG(VISA_LOG_WARNING, "Binary protocol not supported, using text");
+        return false;
+    }
+    // TICK has a binary encoding of its own
+    this->probeTick();
+    return true;
+}
+
+// =============================================================================
+// OPTIONAL COMMANDS
+// =============================================================================
+
+// Commands an older simulator may not know are tried once, when the adapter
+// is set up, with a short deadline and no retry. Silence counts as an error
+// reply: such a simulator then never costs a timeout per call.
+
+int vpVisaAdapter::probeText(const char * request, char * reply, unsigned int capacity)
+{
+    // textMutex held
+    auto saved = timeout;
+    timeout = std::chrono::milliseconds(PROBE_TIMEOUT);
+    int n = this->exchangeText(request, strlen(request), (unsigned char*)reply, capacity - 1, false);
+    timeout = saved;
+    if (n <= 0) return 0;
+    reply[n] = '\0';
+    return strncmp(reply, "ERROR", 5) == 0 ? 0 : n;
+}
+
+void vpVisaAdapter::probeTick()
+{
+    // joint positions only, no velocity applied
+    bool supported;
+    if (binaryProtocol){
+        PendingReply reply;
+        double request = VISA_STATE_JOINTPOS;
+        auto saved = timeout;
+        timeout = std::chrono::milliseconds(PROBE_TIMEOUT);
+        supported = this->exchangeBinary(vpVisaProtocol::OP_TICK, &request, 1, reply, false) &&
+                    reply.data[3] != vpVisaProtocol::OP_ERROR;
+        timeout = saved;
+    }
+    else{
+        std::lock_guard<std::mutex> lock(textMutex);
+        char reply[2048];
+        std::string request = "TICK," + std::to_string((int)VISA_STATE_JOINTPOS);
+        supported = this->probeText(request.c_str(), reply, sizeof(reply)) > 0;
+    }
+    tickSupported = supported;
+    if (!supported) VISA_LOG(VISA_LOG_WARNING, "TICK not supported, using separate requests");
+}
+
+const bool vpVisaAdapter::probePayload(const char * request)
+{
+    // textMutex held. The payload is received and dropped.
+    char reply[500];
+    if (this->probeText(request, reply, sizeof(reply)) == 0) return false;
+    const char * p = reply;
+    while (*p && !isdigit(*p)) p++;
+    int size = atoi(p);
+    if (size <= 0) return false;
+    if (rxBuffer.size() < (size_t)size) rxBuffer.resize(size);
+    return this->receivePayload(rxBuffer.data(), size);
+}
+
+#if defined(WITH_OPENCV) && defined(WITH_VISP)
+void vpVisaAdapter::probeRoi()
+{
+    std::lock_guard<std::mutex> lock(textMutex);
+    roiSupported = this->probePayload("GETIMAGEROI,0,0,1,1");
+    if (!roiSupported) VISA_LOG(VISA_LOG_WARNING, "GETIMAGEROI not supported, using whole images");
+}
+#endif
+
+void vpVisaAdapter::setDeltaTransport(bool enable)
+{
+    std::lock_guard<std::mutex> lock(textMutex);
+    deltaTransport = enable;
+    if (!enable || !connected) return; // tried at connect()
+
+    // a key frame, not kept: the next request asks for one again
+    deltaFrame = 0;
+    if (!this->probePayload("GETIMAGEDELTA,0")){
+        VISA_LOG(VISA_LOG_WARNING, "GETIMAGEDELTA not supported, using whole images");
+        deltaTransport = false;
+    }
+}
+
+// =============================================================================
+// REPLIES DEMULTIPLEXING
+// =============================================================================
+
+// Whichever caller finds nobody reading the socket reads it for everyone: a
+// binary reply goes to the request with the same sequence number, anything
+// else to the text exchange in progress. The socket is non-blocking, every
+// wait is bounded by the deadline of the call.
+
+thread_local vpVisaStatus vpVisaAdapter::lastStatus = VISA_OK;
+
+static bool wouldBlock()
+{
+    #ifdef _WIN32
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+    #else
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    #endif
+}
+
+int vpVisaAdapter::receiveDatagram(unsigned char * buffer, unsigned int capacity, Deadline deadline)
+{
+    while (true){
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+                         deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) return 0;
+
+        #ifdef _WIN32
+            WSAPOLLFD fds = { sock, POLLIN, 0 };
+            int ready = WSAPoll(&fds, 1, (int)((remaining + 999) / 1000));
+        #else
+            struct pollfd fds = { sock, POLLIN, 0 };
+            int ready = ::poll(&fds, 1, (int)((remaining + 999) / 1000));
+        #endif
+        if (ready == 0 || (ready < 0 && wouldBlock())) continue;
+        if (ready < 0) return -1;
+
+        auto n = ::recv(sock, (char*)buffer, capacity, 0);
+        if (n > 0) return n;
+        if (n < 0 && wouldBlock()) continue;
+        return -1; // closed (or shut down by stopGrabber)
+    }
+}
+
+const bool vpVisaAdapter::exchangeBinary(unsigned char opcode, const double * values, unsigned int count,
+                                         PendingReply & reply, bool retry)
+{
+    unsigned char buffer[vpVisaProtocol::MAX_DATAGRAM];
+    std::unique_lock<std::mutex> lock(demuxMutex);
+    if (++nextSequence == 0) ++nextSequence; // 0 is for unnumbered requests
+    reply.sequence = nextSequence;
+    reply.done = false;
+    unsigned int size = vpVisaProtocol::encode(buffer, sizeof(buffer), opcode, values, count, reply.sequence);
+    if (size == 0){
+        lastStatus = VISA_ERROR;
+        return false;
+    }
+    pendingReplies.push_back(&reply);
+    lock.unlock();
+    ioStats.requests++;
+
+    // the same datagram is sent again, a late duplicate reply finds no request
+    int attempts = retry ? retries + 1 : 1;
+    auto slice = timeout / ((1 << attempts) - 1);
+    Deadline deadline = std::chrono::steady_clock::now();
+    Deadline waiting;
+    bool closed = false;
+    for (int attempt = 0; attempt < attempts && !reply.done && !closed; attempt++){
+        if (attempt > 0) ioStats.retries++;
+        deadline += slice * (1 << attempt);
+        auto sending = std::chrono::steady_clock::now();
+        ::send(sock, (const char*)buffer, size, 0);
+        this->recordPhase(VISA_PHASE_SEND, sending);
+        if (attempt == 0) waiting = std::chrono::steady_clock::now();
+
+        lock.lock();
+        while (!reply.done){
+            if (receiving){
+                demuxCondition.wait_until(lock, deadline);
+                if (std::chrono::steady_clock::now() >= deadline) break;
+                continue;
+            }
+            receiving = true;
+            lock.unlock();
+            int n = this->receiveDatagram(demuxBuffer.data(), demuxBuffer.size(), deadline);
+            lock.lock();
+            receiving = false;
+            demuxCondition.notify_all();
+            if (n <= 0){
+                closed = (n < 0);
+                break;
+            }
+            if (!this->deliverBinary(demuxBuffer.data(), n)){
+                textReplies.push_back(std::vector<unsigned char>(demuxBuffer.data(), demuxBuffer.data() + n));
+            }
+        }
+        lock.unlock();
+    }
+
+    lock.lock();
+    pendingReplies.erase(std::find(pendingReplies.begin(), pendingReplies.end(), &reply));
+    if (!reply.done){
+        if (!closed) ioStats.timeouts++;
+        lastStatus = closed ? VISA_ERROR : VISA_TIMEOUT;
+        return false;
+    }
+    this->recordPhase(VISA_PHASE_WAIT, waiting);
+    lastStatus = (reply.data[3] == vpVisaProtocol::OP_ERROR) ? VISA_ERROR : VISA_OK;
+    return true;
+}
+
+const bool vpVisaAdapter::deliverBinary(const unsigned char * datagram, unsigned int size)
+{
+    // demuxMutex held. A reply must fill the datagram exactly, which also
+    // keeps image chunks that happen to start with the magic out.
+    vpVisaProtocol::Header header;
+    const unsigned char * values;
+    if (!vpVisaProtocol::decode(datagram, size, header, values) ||
+        size != vpVisaProtocol::HEADER_SIZE + 8u * header.count){
+        return false;
+    }
+    for (auto reply : pendingReplies){
+        if (reply->sequence == header.sequence && !reply->done){
+            memcpy(reply->data, datagram, size);
+            reply->size = size;
+            reply->done = true;
+            return true;
+        }
+    }
+    for (auto streamed = velocityInFlight.begin(); streamed != velocityInFlight.end(); ++streamed){
+        if (streamed->sequence == header.sequence && streamed->status == VISA_TIMEOUT){
+            // refused ones are reported by the streaming thread
+            if (header.opcode != vpVisaProtocol::OP_OK) streamed->status = VISA_ERROR;
+            else{
+                velocityInFlight.erase(streamed);
+                streamStats.sent++;
+            }
+            return true;
+        }
+    }
+    ioStats.staleReplies++; // answer to a resent or abandoned request
+    return true;
+}
+
+void vpVisaAdapter::beginText()
+{
+    // textMutex held: anything received before the request is stale, a late
+    // reply to a timed out exchange would be taken for the next one
+    std::lock_guard<std::mutex> lock(demuxMutex);
+    ioStats.staleReplies += textReplies.size();
+    textReplies.clear();
+    while (!receiving){
+        auto n = ::recv(sock, (char*)demuxBuffer.data(), demuxBuffer.size(), 0);
+        if (n <= 0) break;
+        if (!this->deliverBinary(demuxBuffer.data(), n)) ioStats.staleReplies++;
+    }
+    lastStatus = VISA_OK;
+}
+
+int vpVisaAdapter::receiveText(unsigned char * dst, unsigned int capacity, Deadline deadline)
+{
+    // textMutex held
+    std::unique_lock<std::mutex> lock(demuxMutex);
+    while (true){
+        if (!textReplies.empty()){
+            unsigned int n = std::min<size_t>(capacity, textReplies.front().size());
+            memcpy(dst, textReplies.front().data(), n);
+            textReplies.pop_front();
+            return n;
+        }
+        if (receiving){
+            demuxCondition.wait_until(lock, deadline);
+            if (textReplies.empty() && std::chrono::steady_clock::now() >= deadline) return 0;
+            continue;
+        }
+        receiving = true;
+        lock.unlock();
+        // straight into dst, unless a binary reply would not fit
+        bool direct = capacity >= vpVisaProtocol::MAX_DATAGRAM;
+        unsigned char * buffer = direct ? dst : demuxBuffer.data();
+        int n = this->receiveDatagram(buffer, direct ? capacity : demuxBuffer.size(), deadline);
+        lock.lock();
+        receiving = false;
+        demuxCondition.notify_all();
+        if (n <= 0) return n;
+        if (this->deliverBinary(buffer, n)) continue;
+        if (!direct){
+            n = std::min<unsigned int>(n, capacity);
+            memcpy(dst, buffer, n);
+        }
+        return n;
+    }
+}
+
+int vpVisaAdapter::exchangeText(const char * request, unsigned int size,
+                                unsigned char * reply, unsigned int capacity, bool retry)
+{
+    // textMutex held. Text replies are matched by order only: a resent
+    // request may be answered twice, beginText() drops the extra answer.
+    this->beginText();
+    ioStats.requests++;
+
+    int attempts = retry ? retries + 1 : 1;
+    auto slice = timeout / ((1 << attempts) - 1);
+    Deadline deadline = std::chrono::steady_clock::now();
+    Deadline waiting;
+    for (int attempt = 0; attempt < attempts; attempt++){
+        if (attempt > 0) ioStats.retries++;
+        deadline += slice * (1 << attempt);
+        auto sending = std::chrono::steady_clock::now();
+        ::send(sock, request, size, 0);
+        this->recordPhase(VISA_PHASE_SEND, sending);
+        if (attempt == 0) waiting = std::chrono::steady_clock::now();
+
+        int n = this->receiveText(reply, capacity, deadline);
+        if (n > 0){
+            this->recordPhase(VISA_PHASE_WAIT, waiting);
+            return n;
+        }
+        if (n < 0){
+            lastStatus = VISA_ERROR;
+            return -1;
+        }
+    }
+    ioStats.timeouts++;
+    lastStatus = VISA_TIMEOUT;
+    return 0;
+}
+
+// =============================================================================
+// COMMANDS
+// =============================================================================
+
+const bool vpVisaAdapter::sendCmd(std::string cmd, std::vector<double> args, bool retry)
+{
+    CallTimer timer(this, VISA_CALL_COMMAND);
+    if (recorder.isOpen()) recorder.recordValues(VISA_RECORD_COMMAND, cmd.c_str(), args.data(), args.size());
+    unsigned char op = vpVisaProtocol::opcode(cmd.c_str(), cmd.size());
+    if (binaryProtocol && op != vpVisaProtocol::OP_NONE){
+        PendingReply reply;
+        if (this->exchangeBinary(op, args.data(), args.size(), reply, retry && vpVisaProtocol::isRepeatable(op)) &&
+            reply.data[3] == vpVisaProtocol::OP_OK){
+            return true;
+        }
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: %s %s", cmd.c_str(), lastStatus == VISA_TIMEOUT ? "timed out" : "failed");
+        return false;
+    }
+
     std::string msg = cmd;
     for (auto i = 0; i < args.size(); i++){
         msg.append(",");
         msg.append( std::to_string(args[i]) );
     }
-    std::cout << msg << std::endl;
-
-    char buffer[1024];
-    strncpy(buffer, msg.c_str(), msg.size());
-    ::send(sock,buffer,msg.size(),0);
+    VISA_LOG(VISA_LOG_DEBUG, "%s", msg.c_str());
 
+    std::lock_guard<std::mutex> lock(textMutex);
     char bufferResponse[500];
-    ::recv(sock, bufferResponse, 500, 0);
+    auto n = this->exchangeText(msg.c_str(), msg.size(), (unsigned char*)bufferResponse, sizeof(bufferResponse)-1,
+                                retry && (op == vpVisaProtocol::OP_NONE || vpVisaProtocol::isRepeatable(op)));
+    if (n <= 0){
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: %s %s", cmd.c_str(), n == 0 ? "timed out" : "failed");
+        return false;
+    }
+    bufferResponse[n] = '\0';
     std::string str(bufferResponse);
     //std::cout << "response from visa" << str << std::endl;
     rtrim(str);
@@ -108,11 +634,79 @@ const bool vpVisaAdapter::sendCmd(std::string cmd, std::vector<double> args)
         return true;
     }
     else{
-        std::cerr << "ERROR: " << bufferResponse << std::endl;
+        lastStatus = VISA_ERROR;
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: %s", bufferResponse);
         return false;
     }
 }
 
+const bool vpVisaAdapter::query(const char * cmd, std::vector<double> & values, const std::vector<double> & args)
+{
+    CallTimer timer(this, VISA_CALL_QUERY);
+    values.clear();
+    if (!args.empty() && recorder.isOpen()) recorder.recordValues(VISA_RECORD_COMMAND, cmd, args.data(), args.size());
+
+    if (binaryProtocol){
+        PendingReply reply;
+        unsigned char op = vpVisaProtocol::opcode(cmd, strlen(cmd));
+        vpVisaProtocol::Header header;
+        const unsigned char * data;
+        if (!this->exchangeBinary(op, args.data(), args.size(), reply, true) ||
+            !vpVisaProtocol::decode(reply.data, reply.size, header, data) ||
+            header.opcode != vpVisaProtocol::OP_VALUES){
+            if (lastStatus == VISA_OK) lastStatus = VISA_ERROR;
+            VISA_LOG(VISA_LOG_ERROR, "ERROR: %s %s", cmd, lastStatus == VISA_TIMEOUT ? "timed out" : "failed");
+            return false;
+        }
+        values.resize(header.count);
+        for (unsigned int i = 0; i < header.count; i++){
+            values[i] = vpVisaProtocol::readDouble(data + 8 * i);
+        }
+        if (recorder.isOpen()) recorder.recordValues(VISA_RECORD_REPLY, cmd, values.data(), values.size());
+        return true;
+    }
+
+    std::string msg = cmd;
+    for (auto i = 0; i < args.size(); i++){
+        char number[32];
+        snprintf(number, sizeof(number), ",%.17g", args[i]);
+        msg.append(number);
+    }
+
+    std::lock_guard<std::mutex> lock(textMutex);
+    char bufferResponse[2048]; //too large but sure to fit
+    auto n = this->exchangeText(msg.c_str(), msg.size(), (unsigned char*)bufferResponse, sizeof(bufferResponse)-1, true);
+    if (n <= 0){
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: no answer to %s", cmd);
+        return false;
+    }
+    bufferResponse[n] = '\0';
+    if (strncmp(bufferResponse, "ERROR", 5) == 0){
+        lastStatus = VISA_ERROR;
+        VISA_LOG(VISA_LOG_ERROR, "%s", bufferResponse);
+        return false;
+    }
+
+    double parsed[vpVisaProtocol::MAX_VALUES];
+    int count = vpVisaProtocol::parseText(bufferResponse, n, parsed, vpVisaProtocol::MAX_VALUES);
+    if (count < 0){
+        lastStatus = VISA_ERROR;
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: malformed answer to %s: %s", cmd, bufferResponse);
+        return false;
+    }
+    values.assign(parsed, parsed + count);
+    if (recorder.isOpen()) recorder.recordValues(VISA_RECORD_REPLY, cmd, parsed, count);
+    return true;
+}
+
+const bool vpVisaAdapter::parseCsv(const char * text, std::vector<double> & values)
+{
+    double parsed[vpVisaProtocol::MAX_VALUES];
+    int count = vpVisaProtocol::parseText(text, strlen(text), parsed, vpVisaProtocol::MAX_VALUES);
+    values.assign(parsed, parsed + std::max(count, 0));
+    return count >= 0;
+}
+
 const bool vpVisaAdapter::setJointPosAbs(std::vector<double> joints)
 {
     return sendCmd("SETJOINTPOSABS",joints);
@@ -133,220 +727,899 @@ const bool vpVisaAdapter::homing()
     return sendCmd("HOMING",{});
 }
 
-void vpVisaAdapter::getCalibMatrix(std::vector<double> & matrix)
+// =============================================================================
+// VELOCITY STREAMING
+// =============================================================================
+
+const bool vpVisaAdapter::startVelocityStream(vpVisaStreamCallback failed)
 {
-    matrix.clear();
-    char buffer[12] = "GETCALIBMAT";
-    char bufferResponse[500]; //too large but sure to fit
-    ::send(sock, buffer,sizeof(buffer)-1,0);
-    ::recv(sock, bufferResponse, 500, 0);
-    std::string str(bufferResponse);
-    rtrim(str);
-    std::vector<std::string> valuesStr = split(str, ',');
+    if (velocityThread.joinable()) return true;
+    if (!connected) return false;
 
-    matrix.clear();
-    matrix.resize(valuesStr.size());
-    for (auto i = 0; i < matrix.size(); i++){
-        matrix[i] = std::stof(valuesStr[i]);
+    velocityFailed = failed;
+    streamStats.queued = streamStats.sent = streamStats.coalesced = streamStats.failed = streamStats.rejected = 0;
+    {
+        std::lock_guard<std::mutex> lock(demuxMutex);
+        velocityInFlight.clear();
     }
+    velocityRunning = true;
+    velocityThread = std::thread(&vpVisaAdapter::velocityLoop, this);
+    return true;
 }
 
-void vpVisaAdapter::getJointPos(std::vector<double> & values)
+void vpVisaAdapter::stopVelocityStream()
 {
-    char buffer[12] = "GETJOINTPOS";
-    char bufferResponse[500]; //too large but sure to fit
-    ::send(sock, buffer,sizeof(buffer)-1,0);
-    ::recv(sock, bufferResponse, 500, 0);
-    std::string str(bufferResponse);
-    rtrim(str);
-    std::vector<std::string> valuesStr = split(str, ',');
+    if (!velocityThread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(velocityMutex);
+        velocityRunning = false;
+        velocityCondition.notify_one();
+    }
+    velocityThread.join();
+}
 
-    values.clear();
-    values.resize(valuesStr.size());
-    for (auto i = 0; i < values.size(); i++){
-        values[i] = std::stof(valuesStr[i]);
+const bool vpVisaAdapter::streamJointVel(const std::vector<double> & velocities)
+{
+    if (!velocityRunning || velocities.size() > MAX_STREAMED_JOINTS) return false;
+
+    VelocityCommand * command = velocityQueue.writeSlot();
+    if (command == NULL){
+        streamStats.rejected++;
+        return false;
     }
+    command->count = velocities.size();
+    std::copy(velocities.begin(), velocities.end(), command->values);
+    velocityQueue.push();
+    streamStats.queued++;
+    // under the lock, or the streaming thread could miss it and sleep on
+    std::lock_guard<std::mutex> lock(velocityMutex);
+    velocityCondition.notify_one();
+    return true;
+}
+
+void vpVisaAdapter::velocityLoop()
+{
+    std::vector<double> velocities, failed;
+    velocities.reserve(MAX_STREAMED_JOINTS);
+    failed.reserve(MAX_STREAMED_JOINTS);
+    bool pending = false;
+    while (true){
+        // only the newest queued velocity is worth sending
+        while (VelocityCommand * command = velocityQueue.front()){
+            if (pending) streamStats.coalesced++;
+            velocities.assign(command->values, command->values + command->count);
+            velocityQueue.pop();
+            pending = true;
+        }
+
+        unsigned int inFlight = binaryProtocol ? this->collectVelocityReplies(failed) : 0;
+        if (pending && inFlight < VELOCITY_WINDOW){
+            pending = false;
+            // a resent velocity could be older than the next one queued
+            bool sent = binaryProtocol ? this->sendVelocity(velocities) : this->sendCmd("SETJOINTVEL", velocities, false);
+            if (sent && !binaryProtocol) streamStats.sent++;
+            if (!sent){
+                streamStats.failed++;
+                if (velocityFailed) velocityFailed(velocities, lastStatus);
+            }
+            continue;
+        }
+        if (!pending && inFlight == 0 && !velocityRunning) break;
+
+        // woken by the next velocity, and every millisecond while
+        // acknowledgements are awaited
+        std::unique_lock<std::mutex> lock(velocityMutex);
+        if (pending || inFlight > 0){
+            velocityCondition.wait_for(lock, std::chrono::milliseconds(1), [this](){ return velocityQueue.front() != NULL; });
+        }
+        else{
+            velocityCondition.wait(lock, [this](){ return velocityQueue.front() != NULL || !velocityRunning; });
+        }
+    }
+}
+
+const bool vpVisaAdapter::sendVelocity(const std::vector<double> & velocities)
+{
+    if (recorder.isOpen()) recorder.recordValues(VISA_RECORD_COMMAND, "SETJOINTVEL", velocities.data(), velocities.size());
+    unsigned char buffer[vpVisaProtocol::MAX_DATAGRAM];
+    std::unique_lock<std::mutex> lock(demuxMutex);
+    if (++nextSequence == 0) ++nextSequence; // 0 is for unnumbered requests
+    unsigned int size = vpVisaProtocol::encode(buffer, sizeof(buffer), vpVisaProtocol::OP_SETJOINTVEL,
+                                               velocities.data(), velocities.size(), nextSequence);
+    if (size == 0){
+        lastStatus = VISA_ERROR;
+        return false;
+    }
+    StreamedVelocity streamed;
+    streamed.sequence = nextSequence;
+    streamed.status = VISA_TIMEOUT;
+    streamed.deadline = std::chrono::steady_clock::now() + timeout;
+    streamed.command.count = velocities.size();
+    std::copy(velocities.begin(), velocities.end(), streamed.command.values);
+    velocityInFlight.push_back(streamed);
+    lock.unlock();
+
+    ioStats.requests++;
+    ::send(sock, (const char*)buffer, size, 0);
+    return true;
+}
+
+unsigned int vpVisaAdapter::collectVelocityReplies(std::vector<double> & failed)
+{
+    std::unique_lock<std::mutex> lock(demuxMutex);
+    // whatever has arrived, unless another thread is reading the socket
+    while (!receiving){
+        auto n = ::recv(sock, (char*)demuxBuffer.data(), demuxBuffer.size(), 0);
+        if (n <= 0) break;
+        if (!this->deliverBinary(demuxBuffer.data(), n)){
+            textReplies.push_back(std::vector<unsigned char>(demuxBuffer.data(), demuxBuffer.data() + n));
+        }
+    }
+
+    // refused or not acknowledged in time, reported outside of the lock
+    auto now = std::chrono::steady_clock::now();
+    size_t i = 0;
+    while (i < velocityInFlight.size()){
+        StreamedVelocity & streamed = velocityInFlight[i];
+        if (streamed.status == VISA_TIMEOUT && streamed.deadline > now){
+            i++;
+            continue;
+        }
+        if (streamed.status == VISA_TIMEOUT) ioStats.timeouts++;
+        vpVisaStatus status = streamed.status;
+        failed.assign(streamed.command.values, streamed.command.values + streamed.command.count);
+        velocityInFlight.erase(velocityInFlight.begin() + i);
+        streamStats.failed++;
+        if (velocityFailed){
+            lock.unlock();
+            velocityFailed(failed, status);
+            lock.lock();
+            i = 0; // replies delivered meanwhile
+        }
+    }
+    return velocityInFlight.size();
+}
+
+const vpVisaStreamStats vpVisaAdapter::getStreamStats() const
+{
+    vpVisaStreamStats stats;
+    stats.queued = streamStats.queued;
+    stats.sent = streamStats.sent;
+    stats.coalesced = streamStats.coalesced;
+    stats.failed = streamStats.failed;
+    stats.rejected = streamStats.rejected;
+    return stats;
+}
+
+void vpVisaAdapter::getCalibMatrix(std::vector<double> & matrix)
+{
+    this->query("GETCALIBMAT", matrix);
+}
+
+void vpVisaAdapter::getJointPos(std::vector<double> & values)
+{
+    this->query("GETJOINTPOS", values);
 }
 
 void vpVisaAdapter::getToolTransform(std::vector<double> & matrix)
 {
-    char buffer[11] = "GETTOOLPOS";
-    char bufferResponse[500]; //too large but sure to fit
-    ::send(sock, buffer,sizeof(buffer)-1,0);
-    ::recv(sock, bufferResponse, 500, 0);
-    std::string str(bufferResponse);
-    rtrim(str);
-    std::vector<std::string> valuesStr = split(str, ',');
+    if (kinematics){
+        vpVisaRobotState state;
+        this->tick({}, VISA_STATE_TOOLPOS, state);
+        matrix.swap(state.toolPos);
+        return;
+    }
+    this->query("GETTOOLPOS", matrix);
+}
 
-    matrix.clear();
-    matrix.resize(valuesStr.size());
-    for (auto i = 0; i < matrix.size(); i++){
-        matrix[i] = std::stof(valuesStr[i]);
+void vpVisaAdapter::getJacobian(std::vector<double> & matrix)
+{
+    if (kinematics){
+        vpVisaRobotState state;
+        this->tick({}, VISA_STATE_JACOBIAN, state);
+        matrix.swap(state.jacobian);
+        return;
     }
+    this->query("GETJACOBIAN", matrix);
 }
 
-std::vector<unsigned char> vpVisaAdapter::getImage()
+const bool vpVisaAdapter::tick(const std::vector<double> & velocities, unsigned int request, vpVisaRobotState & state)
+{
+    CallTimer timer(this, VISA_CALL_QUERY);
+    request &= VISA_STATE_ALL;
+    const unsigned int local = kinematics ? request & (VISA_STATE_TOOLPOS | VISA_STATE_JACOBIAN) : 0;
+    if (local == 0) return this->tickRemote(velocities, request, state);
+
+    // the model only needs q, the simulator is asked for the rest once in a while
+    bool check = kinematicsCheckPeriod > 0 && kinematicsRequests.fetch_add(1) % kinematicsCheckPeriod == 0;
+    if (!this->tickRemote(velocities, check ? request | VISA_STATE_JOINTPOS : (request & ~local) | VISA_STATE_JOINTPOS, state)){
+        return false;
+    }
+    if (check){
+        std::vector<double> fMe, fJe;
+        kinematics->compute(state.jointPos, fMe, fJe);
+        // the simulator values are kept only when the model has drifted
+        if (!this->checkKinematics(local, state, fMe, fJe)) return true;
+        if (local & VISA_STATE_TOOLPOS) state.toolPos.swap(fMe);
+        if (local & VISA_STATE_JACOBIAN) state.jacobian.swap(fJe);
+    }
+    else{
+        kinematics->compute(state.jointPos, state.toolPos, state.jacobian);
+        state.mask |= local;
+    }
+    std::lock_guard<std::mutex> lock(kinematicsMutex);
+    kinematicsStats.computed++;
+    return true;
+}
+
+void vpVisaAdapter::setKinematicModel(std::shared_ptr<vpVisaKinematicModel> model, unsigned int checkPeriod, double tolerance)
+{
+    kinematics = model;
+    kinematicsCheckPeriod = checkPeriod;
+    kinematicsTolerance = tolerance;
+    kinematicsRequests = 0;
+    std::lock_guard<std::mutex> lock(kinematicsMutex);
+    memset(&kinematicsStats, 0, sizeof(kinematicsStats));
+}
+
+const vpVisaKinematicsStats vpVisaAdapter::getKinematicsStats()
+{
+    std::lock_guard<std::mutex> lock(kinematicsMutex);
+    return kinematicsStats;
+}
+
+const bool vpVisaAdapter::checkKinematics(unsigned int request, const vpVisaRobotState & state,
+                                          const std::vector<double> & fMe, const std::vector<double> & fJe)
+{
+    // largest difference, infinite for a size mismatch
+    auto difference = [](const std::vector<double> & a, const std::vector<double> & b) -> double {
+        if (a.size() != b.size()) return INFINITY;
+        double error = 0;
+        for (size_t i = 0; i < a.size(); i++) error = std::max(error, fabs(a[i] - b[i]));
+        return error;
+    };
+    double toolError = (request & VISA_STATE_TOOLPOS) ? difference(fMe, state.toolPos) : 0.0;
+    double jacobianError = (request & VISA_STATE_JACOBIAN) ? difference(fJe, state.jacobian) : 0.0;
+
+    std::lock_guard<std::mutex> lock(kinematicsMutex);
+    kinematicsStats.checks++;
+    kinematicsStats.maxToolError = std::max(kinematicsStats.maxToolError, toolError);
+    kinematicsStats.maxJacobianError = std::max(kinematicsStats.maxJacobianError, jacobianError);
+    if (toolError > kinematicsTolerance || jacobianError > kinematicsTolerance){
+        kinematicsStats.drifts++;
+        VISA_LOG(VISA_LOG_WARNING, "Kinematic model drift: fMe differs by %g, fJe by %g", toolError, jacobianError);
+        return false;
+    }
+    return true;
+}
+
+const bool vpVisaAdapter::tickRemote(const std::vector<double> & velocities, unsigned int request, vpVisaRobotState & state)
 {
+    static const char * queries[] = { "GETJOINTPOS", "GETTOOLPOS", "GETJACOBIAN" };
+    std::vector<double> * quantities[] = { &state.jointPos, &state.toolPos, &state.jacobian };
+    request &= VISA_STATE_ALL;
+    state.mask = 0;
 
+    if (tickSupported){
+        std::vector<double> args(1, request);
+        args.insert(args.end(), velocities.begin(), velocities.end());
 
-    char buffer[9] = "GETIMAGE";
+        std::vector<double> values;
+        if (this->query("TICK", values, args)){
+            if (!unpackTick(request, values, state)){
+                VISA_LOG(VISA_LOG_ERROR, "ERROR: incomplete TICK reply");
+                return false;
+            }
+            return true;
+        }
+        // a lost reply may follow an applied velocity, which is not sent again
+        if (lastStatus != VISA_ERROR) return false;
+        VISA_LOG(VISA_LOG_WARNING, "TICK not supported, using separate requests");
+        tickSupported = false;
+    }
+
+    bool ok = velocities.empty() || this->setJointVel(velocities);
+    for (int i = 0; i < 3; i++){
+        if ((request & (1 << i)) && this->query(queries[i], *quantities[i])) state.mask |= 1 << i;
+    }
+    return ok && state.mask == request;
+}
+
+int vpVisaAdapter::requestPayload(const char * cmd)
+{
+    // textMutex held until the payload is received
+    const char msgPrefix[] = "PACKAGE_LENGTH:";
     char bufferResponse[500]; //UDP max package size
-    std::string msgPrefix = "PACKAGE_LENGTH:";
 
-    ::send(sock, buffer, 8, 0);
-    ::recv(sock, bufferResponse, 500, 0);
+    auto n = this->exchangeText(cmd, strlen(cmd), (unsigned char*)bufferResponse, sizeof(bufferResponse)-1, true);
+    if (n <= 0){
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: no answer to %s", cmd);
+        return -1;
+    }
+    bufferResponse[n] = '\0';
+
+    // skip the prefix and anything that is not a digit
+    const char * p = bufferResponse;
+    if (strncmp(p, msgPrefix, sizeof(msgPrefix)-1) == 0) p += sizeof(msgPrefix)-1;
+    while (*p && !isdigit(*p)) p++;
+    if (!*p){
+        lastStatus = VISA_ERROR;
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: %s", bufferResponse);
+        return -1;
+    }
+    return atoi(p);
+}
+
+int vpVisaAdapter::receivePayloadChunk(unsigned char * payload, unsigned int received, unsigned int size,
+                                       Deadline deadline)
+{
+    auto n = this->receiveText(payload + received, size - received, deadline);
+    if (n <= 0){
+        // a lost chunk cannot be asked again, the next request drops the rest
+        if (n == 0) ioStats.timeouts++;
+        lastStatus = (n == 0) ? VISA_TIMEOUT : VISA_ERROR;
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: image payload truncated (%u/%u)", received, size);
+    }
+    return n;
+}
 
-	std::string message(bufferResponse);
-	message = message.substr(msgPrefix.size(),10);
-	message.erase(std::remove_if(message.begin(), message.end(),
-                        [](char c) { return !std::isdigit(c); }),
-         message.end());
-	int imageSize = std::stoi(message); //parse int
-	//std::cout << "imageSize: " << imageSize << std::endl;
+const bool vpVisaAdapter::receivePayload(unsigned char * dst, unsigned int size)
+{
+    // the payload may span several datagrams, it gets a whole timeout of its own
+    auto start = std::chrono::steady_clock::now();
+    Deadline deadline = start + timeout;
+    unsigned int received = 0;
+    while (received < size){
+        auto n = this->receivePayloadChunk(dst, received, size, deadline);
+        if (n <= 0) return false;
+        received += n;
+    }
+    this->recordPhase(VISA_PHASE_RECEIVE, start);
+    frameStats.bytesReceived = received;
+    return true;
+}
 
+const bool vpVisaAdapter::acquireEncodedImage(bool decodeJpeg, bool record)
+{
+    // textMutex held by the caller until it is done with rxBuffer
+    if (streamingDecode) return this->acquireEncodedImageStreaming(decodeJpeg, record);
+
+    memset(&frameStats, 0, sizeof(frameStats));
+    encodedSize = 0;
+
+    int imageSize = this->requestPayload("GETIMAGE");
+    if (imageSize <= 0) return false;
 
-    char * bufferImage = new char[imageSize+2]; //allocate memory
+    if (rxBuffer.size() < (size_t)imageSize + 2){
+        rxBuffer.resize(imageSize + 2);
+        frameStats.allocations++;
+    }
+    unsigned char * buffer = rxBuffer.data();
 
 	//acquire the image
-//auto start = std::chrono::steady_clock::now();
-	::recv(sock, bufferImage, imageSize+1, MSG_WAITALL);
-    //delete prefix and decode
-//auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
-//std::cout << "Time,ms:" << duration.count() << std::endl;
-
-    
-    std::string encodedImage(bufferImage);
-
-    std::string type = encodedImage.substr(0,23);
-    int start = 23; //jpeg
-    if (type.find("png") != std::string::npos) {
+    if (!this->receivePayload(buffer, imageSize)) return false;
+    buffer[imageSize] = '\0';
+
+    // strip the data URI prefix ("data:image/jpeg;base64," or "data:image/png;base64,")
+    const char * type = (const char *)buffer;
+    unsigned int start = 23; //jpeg
+    if (std::search(type, type + std::min(imageSize, 23), "png", "png" + 3) != type + std::min(imageSize, 23)) {
         start = 22; //png
     }
-    std::cout << type << " : " << start << std::endl;
-    
-    auto res  = base64_decode_array(&bufferImage[start],imageSize - start);
-    delete[] bufferImage;
+    VISA_LOG(VISA_LOG_TRACE, "%.*s : %u", std::min(imageSize, 23), type, start);
+    if ((unsigned int)imageSize < start) return false;
 
-    return res;
+    // decode in place: the image ends up at the beginning of rxBuffer
+    auto decoding = std::chrono::steady_clock::now();
+    encodedSize = base64_decode_into(type + start, imageSize - start, buffer, rxBuffer.size());
+    this->recordPhase(VISA_PHASE_BASE64, decoding);
+    frameStats.bytesDecoded = encodedSize;
+    if (record && encodedSize > 0 && recorder.isOpen()) recorder.recordImage(buffer, encodedSize);
+    return encodedSize > 0;
 }
 
-#ifdef WITH_OPENCV
-cv::Mat vpVisaAdapter::getImageOpenCV()
+const bool vpVisaAdapter::acquireEncodedImageStreaming(bool decodeJpeg, bool record)
 {
-    std::vector<unsigned char> vectordata = this->getImage();
-    cv::Mat data_mat(vectordata,true);
+    // textMutex held, jpegDecoder reset by the caller
+    memset(&frameStats, 0, sizeof(frameStats));
+    encodedSize = 0;
+
+    int imageSize = this->requestPayload("GETIMAGE");
+    if (imageSize <= 0) return false;
+
+    if (rxBuffer.size() < (size_t)imageSize + 2){
+        rxBuffer.resize(imageSize + 2);
+        frameStats.allocations++;
+    }
+    unsigned char * buffer = rxBuffer.data();
+    const unsigned int capacity = rxBuffer.size();
+
+    // Each datagram is base64-decoded in place as soon as it is received, the
+    // decoded bytes accumulate at the beginning of the buffer and are handed
+    // over to the jpeg decoder. The output stays behind the input by more
+    // than the 3 bytes base64_stream_decode needs: 3 bytes out for 4 in,
+    // after a data URI prefix of 22 or 23 characters.
+    base64_stream b64;
+    base64_stream_init(&b64);
+    unsigned int received = 0;
+    unsigned int consumed = 0; // base64 characters already decoded
+    unsigned int decoded = 0;
+    unsigned int start = 0;    // data URI prefix length, 0 until known
+    bool png = false;
+
+    // the decoding interleaved with the reception is timed apart from it
+    std::chrono::steady_clock::duration base64Time(0), decodeTime(0);
+    auto receiving = std::chrono::steady_clock::now();
+    Deadline deadline = receiving + timeout;
+    while (received < (unsigned int)imageSize){
+        auto n = this->receivePayloadChunk(buffer, received, imageSize, deadline);
+        if (n <= 0) return false;
+        received += n;
+
+        if (start == 0){
+            if (received < 23 && received < (unsigned int)imageSize) continue;
+            const char * type = (const char *)buffer;
+            unsigned int typeSize = std::min(received, 23u);
+            png = std::search(type, type + typeSize, "png", "png" + 3) != type + typeSize;
+            start = png ? 22 : 23;
+            VISA_LOG(VISA_LOG_TRACE, "%.*s : %u", (int)typeSize, type, start);
+            consumed = std::min(start, received);
+        }
+
+        auto decoding = std::chrono::steady_clock::now();
+        decoded += base64_stream_decode(&b64, (const char *)buffer + consumed, received - consumed,
+                                        buffer + decoded, capacity - decoded);
+        consumed = received;
+        base64Time += std::chrono::steady_clock::now() - decoding;
+
+        #ifdef WITH_JPEG
+            if (decodeJpeg && !png){
+                decoding = std::chrono::steady_clock::now();
+                jpegDecoder.feed(buffer, decoded, false);
+                decodeTime += std::chrono::steady_clock::now() - decoding;
+            }
+        #endif
+    }
+    this->recordPhase(VISA_PHASE_RECEIVE, std::chrono::steady_clock::now() - receiving - base64Time - decodeTime);
+
+    auto decoding = std::chrono::steady_clock::now();
+    decoded += base64_stream_finish(&b64, buffer + decoded, capacity - decoded);
+    this->recordPhase(VISA_PHASE_BASE64, std::chrono::steady_clock::now() - decoding + base64Time);
+
+    #ifdef WITH_JPEG
+        if (decodeJpeg && !png){
+            decoding = std::chrono::steady_clock::now();
+            jpegDecoder.feed(buffer, decoded, true);
+            this->recordPhase(VISA_PHASE_DECODE, std::chrono::steady_clock::now() - decoding + decodeTime);
+        }
+    #endif
+
+    frameStats.bytesReceived = received;
+    frameStats.bytesDecoded = encodedSize = decoded;
+    if (record && encodedSize > 0 && recorder.isOpen()) recorder.recordImage(buffer, encodedSize);
+    return encodedSize > 0;
+}
+
+void vpVisaAdapter::recordFrame(const vpVisaFrame & frame)
+{
+    // the frame itself while the pool has one to spare for the next call,
+    // a copy otherwise
+    if (!recorder.isOpen()) return;
+    if (framePool->getFreeCount() > 1) recorder.recordFrame(frame);
+    else if (frame.getWidth() > 0) recorder.recordGrey(frame.data(), frame.getWidth(), frame.getHeight());
+    else recorder.recordImage(frame.data(), frame.size());
+}
+
+void vpVisaAdapter::countCopy(unsigned int bytes, unsigned int allocations)
+{
+    // after the image call has released textMutex
+    std::lock_guard<std::mutex> lock(textMutex);
+    frameStats.bytesCopied += bytes;
+    frameStats.allocations += allocations;
+}
+
+const bool vpVisaAdapter::getImage(const unsigned char * & data, unsigned int & size)
+{
+    CallTimer timer(this, VISA_CALL_IMAGE);
+    std::lock_guard<std::mutex> lock(textMutex);
+    if (!this->acquireEncodedImage()){
+        data = NULL;
+        size = 0;
+        return false;
+    }
+    data = rxBuffer.data();
+    size = encodedSize;
+    return true;
+}
 
-    cv::Mat image(cv::imdecode(data_mat,1)); //put 0 if you want greyscale
+std::vector<unsigned char> vpVisaAdapter::getImage()
+{
+    CallTimer timer(this, VISA_CALL_IMAGE);
+    std::lock_guard<std::mutex> lock(textMutex);
+    if (!this->acquireEncodedImage()) return std::vector<unsigned char>();
+    frameStats.bytesCopied += encodedSize;
+    auto copying = std::chrono::steady_clock::now();
+    std::vector<unsigned char> image(rxBuffer.data(), rxBuffer.data() + encodedSize);
+    this->recordPhase(VISA_PHASE_CONVERT, copying);
     return image;
 }
 
-cv::Mat vpVisaAdapter::getImageBWOpenCV()
+vpVisaFrame vpVisaAdapter::acquireFrame()
 {
-    char buffer[11] = "GETIMAGEBW";
-    char bufferResponse[500]; //UDP max package size
-    std::string msgPrefix = "PACKAGE_LENGTH:";
+    vpVisaFrame frame;
+    if (framePool) frame = framePool->acquire();
+    if (frame.empty()){
+        lastStatus = VISA_ERROR;
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: no free frame in the pool (%u frames held)", framePoolSize);
+    }
+    return frame;
+}
 
-    ::send(sock, buffer, 10, 0);
-    ::recv(sock, bufferResponse, 500, 0);
+const bool vpVisaAdapter::getImage(vpVisaFrame & frame)
+{
+    CallTimer timer(this, VISA_CALL_IMAGE);
+    frame.release(); // may be the frame taken next
+    frame = this->acquireFrame();
+    if (frame.empty()) return false;
 
-	std::string message(bufferResponse);
-	message = message.substr(msgPrefix.size(),10);
-	message.erase(std::remove_if(message.begin(), message.end(),
-                        [](char c) { return !std::isdigit(c); }),
-                    message.end());
-	int imageSize = std::stoi(message); //parse int
+    std::lock_guard<std::mutex> lock(textMutex);
+    if (!this->acquireEncodedImage(false, false)) return false;
+    const unsigned char * data = rxBuffer.data();
+    unsigned int size = encodedSize;
+    if (size > frame.capacity()){
+        lastStatus = VISA_ERROR;
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: image of %u bytes larger than the pool frames", size);
+        return false;
+    }
+    auto copying = std::chrono::steady_clock::now();
+    memcpy(frame.data(), data, size); // compressed, a fraction of the payload
+    this->recordPhase(VISA_PHASE_CONVERT, copying);
+    frame.setSize(size);
+    frameStats.bytesCopied += size;
+    this->recordFrame(frame);
+    return true;
+}
 
-    //unsigned char * bufferImage = new unsigned char[imageSize+2]; //allocate memory
-	//acquire the image
-	::recv(sock, bufferImage, imageSize+1, MSG_WAITALL);
+const bool vpVisaAdapter::getImageBW(vpVisaFrame & frame)
+{
+    CallTimer timer(this, VISA_CALL_IMAGEBW);
+    frame.release(); // may be the frame taken next
+    frame = this->acquireFrame();
+    if (frame.empty()) return false;
+
+    std::lock_guard<std::mutex> lock(textMutex);
+    memset(&frameStats, 0, sizeof(frameStats));
+    if (!this->receiveGrey(frame.data())) return false;
+    frame.setImageSize(imageWidth, imageHeight);
+    this->recordFrame(frame);
+    return true;
+}
+
+const bool vpVisaAdapter::receiveGrey(unsigned char * dst)
+{
+    // textMutex held
+    const unsigned int greySize = imageWidth * imageHeight;
+    if (deltaTransport){
+        std::string cmd = "GETIMAGEDELTA," + std::to_string(deltaFrame);
+        int payloadSize = this->requestPayload(cmd.c_str());
+        if (payloadSize > 0){
+            if ((unsigned int)payloadSize > vpVisaProtocol::DELTA_HEADER_SIZE + greySize){
+                VISA_LOG(VISA_LOG_ERROR, "ERROR: unexpected delta image size %d", payloadSize);
+                return false;
+            }
+            if (rxBuffer.size() < (size_t)payloadSize){
+                rxBuffer.resize(payloadSize);
+                frameStats.allocations++;
+            }
+            if (deltaImage.size() != greySize){
+                deltaImage.assign(greySize, 0);
+                deltaFrame = 0;
+                frameStats.allocations++;
+            }
+            if (!this->receivePayload(rxBuffer.data(), payloadSize)) return false;
+            auto decoding = std::chrono::steady_clock::now();
+            if (!vpVisaProtocol::applyDelta(rxBuffer.data(), payloadSize, deltaImage.data(),
+                                            imageWidth, imageHeight, deltaFrame)){
+                // the next request asks for a key frame
+                VISA_LOG(VISA_LOG_ERROR, "ERROR: delta image does not apply to frame %u", deltaFrame);
+                deltaFrame = 0;
+                return false;
+            }
+            this->recordPhase(VISA_PHASE_DECODE, decoding);
+            auto copying = std::chrono::steady_clock::now();
+            memcpy(dst, deltaImage.data(), greySize);
+            this->recordPhase(VISA_PHASE_CONVERT, copying);
+            frameStats.bytesCopied = greySize;
+            return true;
+        }
+        if (lastStatus != VISA_ERROR) return false;
+        VISA_LOG(VISA_LOG_WARNING, "GETIMAGEDELTA not supported, using whole images");
+        deltaTransport = false;
+    }
+
+    int imageSize = this->requestPayload("GETIMAGEBW");
+    if (imageSize <= 0) return false;
+    if ((unsigned int)imageSize != greySize){
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: unexpected BW image size %d", imageSize);
+        return false;
+    }
+    // received straight into dst
+    return this->receivePayload(dst, imageSize);
+}
+
+#ifdef WITH_OPENCV
+const bool vpVisaAdapter::getImageOpenCV(cv::Mat & image)
+{
+    CallTimer timer(this, VISA_CALL_IMAGE);
+    // the decoder target and rxBuffer are used until the image is decoded
+    std::lock_guard<std::mutex> lock(textMutex);
+    const unsigned char * previous = image.data;
+    bool decodeJpeg = false;
 
-    cv::Mat image(480, 640, CV_8UC1, bufferImage);
+    #ifdef WITH_JPEG
+    if (streamingDecode){
+        jpegDecoder.reset(false, [&image](unsigned int width, unsigned int height,
+                                          unsigned int channels, unsigned int & stride) -> unsigned char * {
+            image.create(height, width, channels == 3 ? CV_8UC3 : CV_8UC1);
+            stride = image.step;
+            return image.data;
+        });
+        decodeJpeg = true;
+    }
+    #endif
+
+    if (!this->acquireEncodedImage(decodeJpeg)) return false;
+
+    #ifdef WITH_JPEG
+    if (decodeJpeg && jpegDecoder.getState() == vpJpegStreamDecoder::DONE){
+        if (image.data != previous) frameStats.allocations++;
+        return true;
+    }
+    // png payload or jpeg decoding error: decode the whole image below
+    #endif
+
+    auto decoding = std::chrono::steady_clock::now();
+    cv::Mat encoded(1, encodedSize, CV_8UC1, (void*)rxBuffer.data()); // header only, no copy
+    cv::imdecode(encoded, cv::IMREAD_COLOR, &image);
+    this->recordPhase(VISA_PHASE_DECODE, decoding);
+    if (image.data != previous) frameStats.allocations++;
+    return !image.empty();
+}
+
+cv::Mat vpVisaAdapter::getImageOpenCV()
+{
+    CallTimer timer(this, VISA_CALL_IMAGE);
+    cv::Mat image;
+    this->getImageOpenCV(image);
+    return image;
+}
+
+cv::Mat vpVisaAdapter::getImageBWOpenCV()
+{
+    // the image owns its pixels, getImageBW() avoids the copy
+    CallTimer timer(this, VISA_CALL_IMAGEBW);
+    vpVisaFrame frame;
+    if (!this->getImageBW(frame)) return cv::Mat();
+    this->countCopy(frame.size(), 1);
+    auto copying = std::chrono::steady_clock::now();
+    cv::Mat image = frame.toOpenCV().clone();
+    this->recordPhase(VISA_PHASE_CONVERT, copying);
     return image;
 }
 #endif
 
 #if defined(WITH_OPENCV) && defined(WITH_VISP)
+const bool vpVisaAdapter::getImageViSP(vpImage<unsigned char> & I)
+{
+    // Luminance only, decoded straight into the caller's bitmap: the jpeg
+    // chroma planes are neither decoded nor converted.
+    CallTimer timer(this, VISA_CALL_IMAGE);
+    std::lock_guard<std::mutex> lock(textMutex);
+    const unsigned char * previous = I.bitmap;
+    bool decodeJpeg = false;
+
+    #ifdef WITH_JPEG
+    if (streamingDecode){
+        jpegDecoder.reset(true, [&I](unsigned int width, unsigned int height,
+                                     unsigned int channels, unsigned int & stride) -> unsigned char * {
+            if (I.getHeight() != height || I.getWidth() != width) I.resize(height, width);
+            stride = width;
+            return I.bitmap;
+        });
+        decodeJpeg = true;
+    }
+    #endif
+
+    if (!this->acquireEncodedImage(decodeJpeg)) return false;
+
+    #ifdef WITH_JPEG
+    if (decodeJpeg && jpegDecoder.getState() == vpJpegStreamDecoder::DONE){
+        if (I.bitmap != previous) frameStats.allocations++;
+        return true;
+    }
+    #endif
+
+    // the size is known from the calibration, imdecode reuses the bitmap when it matches
+    if (I.getHeight() != imageHeight || I.getWidth() != imageWidth) I.resize(imageHeight, imageWidth);
+    auto decoding = std::chrono::steady_clock::now();
+    cv::Mat encoded(1, encodedSize, CV_8UC1, (void*)rxBuffer.data()); // header only, no copy
+    cv::Mat grey(I.getHeight(), I.getWidth(), CV_8UC1, I.bitmap);
+    cv::imdecode(encoded, cv::IMREAD_GRAYSCALE, &grey);
+    this->recordPhase(VISA_PHASE_DECODE, decoding);
+    if (grey.empty()) return false;
+    if (grey.data != I.bitmap){
+        auto copying = std::chrono::steady_clock::now();
+        I.resize(grey.rows, grey.cols);
+        memcpy(I.bitmap, grey.data, (size_t)grey.rows * grey.cols);
+        frameStats.bytesCopied += grey.rows * grey.cols;
+        this->recordPhase(VISA_PHASE_CONVERT, copying);
+    }
+    if (I.bitmap != previous) frameStats.allocations++;
+    return true;
+}
+
+const bool vpVisaAdapter::getImageBWViSP(vpImage<unsigned char> & I)
+{
+    CallTimer timer(this, VISA_CALL_IMAGEBW);
+    std::lock_guard<std::mutex> lock(textMutex);
+    memset(&frameStats, 0, sizeof(frameStats));
+    if (I.getHeight() != imageHeight || I.getWidth() != imageWidth){
+        I.resize(imageHeight, imageWidth);
+        frameStats.allocations++;
+    }
+    // straight into the caller's bitmap
+    if (!this->receiveGrey(I.bitmap)) return false;
+    if (recorder.isOpen()) recorder.recordGrey(I.bitmap, imageWidth, imageHeight);
+    return true;
+}
+
+const bool vpVisaAdapter::getImageROI(vpImage<unsigned char> & I, const std::vector<vpRect> & rects)
+{
+    CallTimer timer(this, VISA_CALL_IMAGEBW);
+    if (!roiSupported || I.getHeight() != imageHeight || I.getWidth() != imageWidth){
+        return this->getImageBWViSP(I);
+    }
+
+    // "GETIMAGEROI,left,top,width,height,..." in whole pixels, the payload is
+    // every window in turn, rows of grey pixels
+    std::vector<unsigned int> windows;
+    std::string cmd = "GETIMAGEROI";
+    unsigned int roiSize = 0;
+    for (const auto & rect : rects){
+        int left = std::max(0, (int)floor(rect.getLeft()));
+        int top = std::max(0, (int)floor(rect.getTop()));
+        int right = std::min((int)imageWidth, (int)ceil(rect.getRight()) + 1);
+        int bottom = std::min((int)imageHeight, (int)ceil(rect.getBottom()) + 1);
+        if (right <= left || bottom <= top) continue;
+
+        unsigned int window[4] = { (unsigned int)left, (unsigned int)top,
+                                   (unsigned int)(right - left), (unsigned int)(bottom - top) };
+        for (auto v : window) cmd += "," + std::to_string(v);
+        windows.insert(windows.end(), window, window + 4);
+        roiSize += window[2] * window[3];
+    }
+    // every feature out of the image: a whole new image, not a stale one
+    if (windows.empty()) return this->getImageBWViSP(I);
+
+    {
+        std::lock_guard<std::mutex> lock(textMutex);
+        memset(&frameStats, 0, sizeof(frameStats));
+        int imageSize = this->requestPayload(cmd.c_str());
+        if (imageSize > 0){
+            if ((unsigned int)imageSize != roiSize){
+                VISA_LOG(VISA_LOG_ERROR, "ERROR: unexpected ROI size %d instead of %u", imageSize, roiSize);
+                return false;
+            }
+            if (rxBuffer.size() < roiSize){
+                rxBuffer.resize(roiSize);
+                frameStats.allocations++;
+            }
+            if (!this->receivePayload(rxBuffer.data(), roiSize)) return false;
+
+            auto copying = std::chrono::steady_clock::now();
+            const unsigned char * src = rxBuffer.data();
+            for (size_t i = 0; i < windows.size(); i += 4){
+                for (unsigned int y = 0; y < windows[i+3]; y++){
+                    memcpy(I[windows[i+1] + y] + windows[i], src, windows[i+2]);
+                    src += windows[i+2];
+                }
+            }
+            this->recordPhase(VISA_PHASE_CONVERT, copying);
+            frameStats.bytesCopied = roiSize;
+            // the image as the caller sees it, stale outside the windows
+            if (recorder.isOpen()) recorder.recordGrey(I.bitmap, imageWidth, imageHeight);
+            return true;
+        }
+        if (lastStatus != VISA_ERROR) return false;
+        VISA_LOG(VISA_LOG_WARNING, "GETIMAGEROI not supported, using whole images");
+        roiSupported = false;
+    }
+    return this->getImageBWViSP(I);
+}
+
+const bool vpVisaAdapter::startGrabber()
+{
+    if (grabberAdapter != NULL) return true;
+    if (!connected) return false;
+
+    // replies to the second socket never mix with the ones of this connection
+    grabberAdapter = new vpVisaAdapter();
+    if (!grabberAdapter->connect(host.c_str(), port)){
+        delete grabberAdapter;
+        grabberAdapter = NULL;
+        return false;
+    }
+    grabberAdapter->setStreamingDecode(streamingDecode);
+
+    grabberRunning = true;
+    grabberThread = std::thread(&vpVisaAdapter::grabberLoop, this);
+    return true;
+}
+
+void vpVisaAdapter::stopGrabber()
+{
+    if (grabberAdapter == NULL) return;
+
+    grabberRunning = false;
+    // wake up the grabber if it is blocked in recv
+    #ifdef _WIN32
+        ::shutdown(grabberAdapter->sock, SD_BOTH);
+    #else
+        ::shutdown(grabberAdapter->sock, SHUT_RDWR);
+    #endif
+    grabberThread.join();
+
+    delete grabberAdapter;
+    grabberAdapter = NULL;
+}
+
+void vpVisaAdapter::grabberLoop()
+{
+    while (grabberRunning){
+        GrabbedFrame & frame = grabbedFrames.writeBuffer();
+        if (!grabberAdapter->getImageViSP(frame.I)){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        frame.info.sequence = ++grabbedSequence;
+        frame.info.timestamp = std::chrono::steady_clock::now();
+        grabbedFrames.publish();
+    }
+}
+
+const bool vpVisaAdapter::getLatestImageViSP(vpImage<unsigned char> & I, vpVisaFrameInfo & info)
+{
+    bool fresh = grabbedFrames.update();
+    const GrabbedFrame & frame = grabbedFrames.readBuffer();
+    info = frame.info;
+    if (frame.info.sequence == 0) return false; // nothing grabbed yet
+
+    if (fresh){
+        droppedFrames += frame.info.sequence - lastSequence - 1;
+        lastSequence = frame.info.sequence;
+    }
+    else{
+        duplicatedFrames++;
+    }
+    I = frame.I;
+    return fresh;
+}
+
 vpImage<unsigned char> vpVisaAdapter::getImageViSP()
 {
+    CallTimer timer(this, VISA_CALL_IMAGE);
     vpImage<unsigned char> I;
-    vpImageConvert::convert(this->getImageOpenCV(), I);
+    this->getImageViSP(I);
+    this->countCopy(I.getSize(), 0);
     return I;
 }
 
 vpImage<unsigned char> vpVisaAdapter::getImageBWViSP()
 {
+    CallTimer timer(this, VISA_CALL_IMAGEBW);
     vpImage<unsigned char> I;
-    vpImageConvert::convert(this->getImageBWOpenCV(), I);
+    this->getImageBWViSP(I);
+    this->countCopy(I.getSize(), 0);
     return I;
 }
-
-vpMatrix vpVisaAdapter::get_fJe()
-{
-    char buffer[12] = "GETJACOBIAN";
-    char bufferResponse[500]; //too large but sure to fit
-    ::send(sock, buffer,sizeof(buffer)-1,0);
-    ::recv(sock, bufferResponse, 500, 0);
-    std::string str(bufferResponse);
-    rtrim(str);
-    std::vector<std::string> valuesStr = split(str, ',');
-
-    std::vector<double> values;
-    values.clear();
-    values.resize(valuesStr.size());
-    for (auto i = 0; i < values.size(); i++){
-        values[i] = std::stof(valuesStr[i]);
-    }
-
-    vpMatrix J;
-    int nbDOFs = values.size() / 6;
-    J = vpMatrix(6, nbDOFs);
-    for (int i = 0; i < 6; i++){
-        for (int j = 0; j < nbDOFs; j++){
-            J[i][j] = values[nbDOFs*i + j];
-        }        
-    }
-    return J;
-}
-
-vpHomogeneousMatrix vpVisaAdapter::get_fMe(){
-    std::vector<double> fMe_vector;
-    this->getToolTransform(fMe_vector);
-
-    vpHomogeneousMatrix fMe;
-    for (int i = 0; i < 4; i++){
-        for (int j = 0; j < 4; j++){
-            fMe[i][j] = fMe_vector[4*j+i];
-        }   
-    }
-    return fMe;
-}
-
-vpMatrix vpVisaAdapter::get_eJe()
-{
-    auto fMe = this->get_fMe();
-    auto fJe = this->get_fJe();
-    vpVelocityTwistMatrix tmp(fMe.inverse());
-    vpVelocityTwistMatrix fVe;
-    fVe[0][0] = tmp[0][0];
-    fVe[0][1] = tmp[0][1];
-    fVe[0][2] = tmp[0][2];
-    fVe[1][0] = tmp[1][0];
-    fVe[1][1] = tmp[1][1];
-    fVe[1][2] = tmp[1][2];
-    fVe[2][0] = tmp[2][0];
-    fVe[2][1] = tmp[2][1];
-    fVe[2][2] = tmp[2][2];
-
-    fVe[3][3] = tmp[3][3];
-    fVe[3][4] = tmp[3][4];
-    fVe[3][5] = tmp[3][5];
-    fVe[4][3] = tmp[4][3];
-    fVe[4][4] = tmp[4][4];
-    fVe[4][5] = tmp[4][5];
-    fVe[5][3] = tmp[5][3];
-    fVe[5][4] = tmp[5][4];
-    fVe[5][5] = tmp[5][5];
-
-    return fVe * fJe;
-}
 #endif
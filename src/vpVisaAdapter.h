@@ -10,8 +10,13 @@
 #include <vector>
 #include <string>
 #include <string.h>
+#include <sstream>
+#include <algorithm>
 
 #include <cpp-base64/base64.h>
+#include "vpJpegStreamDecoder.h"
+#include "vpVisaBackend.h"
+#include "vpVisaProtocol.h"
 
 #ifdef WITH_OPENCV
 #include <opencv2/opencv.hpp>
@@ -19,6 +24,7 @@
 
 #ifdef WITH_VISP
 #include <visp3/io/vpImageIo.h>
+#include <visp3/core/vpRect.h>
 #endif
 
 #ifdef _WIN32
@@ -31,6 +37,8 @@
 #elif __linux__ || __APPLE__
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <time.h>
 #include <sys/types.h>
@@ -42,8 +50,110 @@
 
 #include <iostream>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 
-class vpVisaAdapter
+#include "vpSpscQueue.h"
+#include "vpTripleBuffer.h"
+#include "vpVisaFramePool.h"
+#include "vpVisaKinematics.h"
+#include "vpVisaLatency.h"
+#include "vpVisaLog.h"
+#include "vpVisaRecorder.h"
+
+// Per-frame accounting of the image acquisition path
+struct vpVisaFrameStats
+{
+    unsigned int bytesReceived; // payload bytes read from the socket
+    unsigned int bytesDecoded;  // encoded image (jpeg/png) bytes after base64 decoding
+    unsigned int bytesCopied;   // bytes copied after reception (0 on the zero-copy path)
+    unsigned int allocations;   // buffer (re)allocations made by the adapter
+};
+
+// Socket level accounting, since connect()
+struct vpVisaIoStats
+{
+    unsigned long long requests;     // exchanges started with the simulator
+    unsigned long long retries;      // requests sent again after a silent attempt
+    unsigned long long timeouts;     // calls that reached their deadline
+    unsigned long long staleReplies; // late or duplicate replies dropped
+};
+
+// Kinds of calls and their phases, see vpVisaAdapter::getStats()
+enum vpVisaCall
+{
+    VISA_CALL_COMMAND = 0, // set*, homing
+    VISA_CALL_QUERY,       // get* numeric values, tick
+    VISA_CALL_IMAGE,       // encoded images: getImage*, except the BW ones
+    VISA_CALL_IMAGEBW,     // grey images: getImageBW*, getImageROI
+    VISA_CALL_COUNT
+};
+
+enum vpVisaPhase
+{
+    VISA_PHASE_SEND = 0, // writing the request to the socket
+    VISA_PHASE_WAIT,     // from the request to its reply (an image header)
+    VISA_PHASE_RECEIVE,  // image payload
+    VISA_PHASE_BASE64,
+    VISA_PHASE_DECODE,   // jpeg/png decoding, delta frame reconstruction
+    VISA_PHASE_CONVERT,  // copies into the caller's image
+    VISA_PHASE_CALL,     // whole call
+    VISA_PHASE_COUNT
+};
+
+struct vpVisaLatencyStats
+{
+    vpVisaLatency latency[VISA_CALL_COUNT][VISA_PHASE_COUNT];
+};
+
+// Outcome of a call, see vpVisaAdapter::getLastStatus()
+enum vpVisaStatus
+{
+    VISA_OK = 0,
+    VISA_TIMEOUT, // no (complete) answer before the deadline
+    VISA_ERROR    // error reply, or socket closed
+};
+
+// Velocity streaming accounting, since startVelocityStream()
+struct vpVisaStreamStats
+{
+    unsigned long long queued;    // velocities accepted by streamJointVel()
+    unsigned long long sent;      // acknowledged by the simulator
+    unsigned long long coalesced; // replaced by a newer one before being sent
+    unsigned long long failed;    // not acknowledged, see vpVisaStreamCallback
+    unsigned long long rejected;  // queue full
+};
+
+// Local kinematics accounting, since setKinematicModel()
+struct vpVisaKinematicsStats
+{
+    unsigned long long computed; // requests answered by the model
+    unsigned long long checks;   // compared with the simulator
+    unsigned long long drifts;   // checks beyond the tolerance
+    double maxToolError;         // largest difference on fMe
+    double maxJacobianError;     // on fJe
+};
+
+// called by the streaming thread for every velocity that was not acknowledged
+typedef std::function<void(const std::vector<double> & velocities, vpVisaStatus status)> vpVisaStreamCallback;
+
+// Frame delivered by the background grabber
+struct vpVisaFrameInfo
+{
+    unsigned long long sequence; // grabbed frame number, 0 before the first frame
+    std::chrono::steady_clock::time_point timestamp; // reception of the frame
+};
+
+// An adapter can be shared between threads. In binary mode, the numeric
+// queries and commands of all the threads are in flight together on the one
+// socket, each reply is matched to its request by its sequence number. Text
+// exchanges and image transfers are serialized with each other, but not with
+// the binary requests.
+class vpVisaAdapter : public vpVisaBackend
 {
     public:
 
@@ -53,28 +163,144 @@ class vpVisaAdapter
         void disconnect();
         const bool isConnected(){ return connected; }
 
+        // deadline of every call (default 1000 ms), within which a silent
+        // request is sent up to retries more times with exponential backoff,
+        // unless repeating it is unsafe (SETJOINTPOSREL). An image payload
+        // gets a deadline of its own once its header is received.
+        void setTimeout(unsigned int ms, unsigned int retries = 2);
+        // status of the last call made by the calling thread
+        static vpVisaStatus getLastStatus(){ return lastStatus; }
+        const vpVisaIoStats getIoStats() const;
+
+        // latency of every call since connect() or resetStats(), per kind of
+        // call and per phase. Always recorded: a clock read and a few relaxed
+        // atomic increments per phase, nothing is locked.
+        const vpVisaLatencyStats getStats() const;
+        void resetStats();
+        void printStats(std::ostream &) const;
+        // logs the statistics every periodMs (0: never), from the thread that
+        // completes the first call after each period
+        void setStatsDump(unsigned int periodMs);
+
+        // appends every image received, command sent and query answered to a
+        // session log (see vpVisaRecorder), once connected. A background
+        // thread writes the log: images into a vpVisaFrame are recorded
+        // without a copy (the frame stays held until written, so it must
+        // not be modified), other data is copied on the calling thread.
+        // Not while other threads use the adapter.
+        const bool startRecording(const std::string & path);
+        void stopRecording();
+        const bool isRecording() const { return recorder.isOpen(); }
+        const vpVisaRecorderStats getRecordingStats() const { return recorder.getStats(); }
+
+        // negotiates the binary encoding of the numeric queries and commands,
+        // the text protocol stays in use if the simulator does not support it.
+        // To be called before the adapter is shared between threads.
+        const bool setBinaryProtocol(bool enable);
+        const bool isBinaryProtocol(){ return binaryProtocol; }
+
         const bool setJointPosAbs(std::vector<double>);
         const bool setJointPosRel(std::vector<double>);
         const bool setJointVel(std::vector<double>);
         const bool homing();
 
+        // Fire and forget joint velocities: streamJointVel() only queues them
+        // (for a single calling thread, it never waits on the network) and a
+        // background thread sends them, without retries. In binary mode it
+        // does not wait for the acknowledgements either: up to
+        // VELOCITY_WINDOW velocities are in flight, each OK is matched to
+        // its velocity by sequence number. In text mode it waits for each
+        // OK. Velocities queued while it cannot send are coalesced, only the
+        // newest one is sent next.
+        const bool startVelocityStream(vpVisaStreamCallback failed = vpVisaStreamCallback());
+        // sends the newest queued velocity, waits for the velocities in
+        // flight, then stops the thread
+        void stopVelocityStream();
+        const bool streamJointVel(const std::vector<double> &);
+        const vpVisaStreamStats getStreamStats() const;
+        static const unsigned int MAX_STREAMED_JOINTS = 16;
+        static const unsigned int VELOCITY_WINDOW = 32;
+
         void getJointPos(std::vector<double> & );
         void getToolTransform(std::vector<double> & );
         void getCalibMatrix(std::vector<double> & );
+        void getJacobian(std::vector<double> & );
+        // parses a text reply ("v1,v2,..."), false if it is malformed
+        static const bool parseCsv(const char *, std::vector<double> &);
+
+        // one round trip per control cycle: applies the joint velocities (none
+        // if empty) then reads the requested state (vpVisaStateRequest mask).
+        // Separate requests are used if the simulator did not answer TICK when
+        // the adapter was set up, or answers it with an error later on. A
+        // timeout only fails the call.
+        const bool tick(const std::vector<double> & velocities, unsigned int request, vpVisaRobotState & state);
+
+        // fMe and fJe (tick(), getToolTransform(), getJacobian()) computed
+        // from the joint positions, the only state then read from the
+        // simulator. Every checkPeriod requests (0: never) the simulator is
+        // asked for them too: the local values are returned unless they
+        // differ by more than tolerance, the simulator's are then returned
+        // and the drift is logged. NULL to read them from the simulator again. To be called before the
+        // adapter is shared between threads.
+        void setKinematicModel(std::shared_ptr<vpVisaKinematicModel> model, unsigned int checkPeriod = 100,
+                               double tolerance = 1e-4);
+        const vpVisaKinematicsStats getKinematicsStats();
         
         std::vector<unsigned char> getImage();
+        // zero-copy: data points to the encoded image inside the receive buffer,
+        // valid until the next image request, NULL and 0 on failure.
+        const bool getImage(const unsigned char * & data, unsigned int & size);
+        // of the last image call, updated under the same lock as the transfer
+        const vpVisaFrameStats & getLastFrameStats() const { return frameStats; }
+
+        // Frames from a fixed pool sized from the calibrated resolution at
+        // connect() (setFramePoolSize() before, 4 frames by default). Nothing
+        // is allocated per frame and a frame stays valid while it is held,
+        // whatever the adapter does next. They fail when every frame is held.
+        void setFramePoolSize(unsigned int frames){ framePoolSize = frames; }
+        const bool getImage(vpVisaFrame &);   // encoded jpeg or png
+        const bool getImageBW(vpVisaFrame &); // grey, width x height
+
+        // grey images (getImageBW*) as the 16x16 tiles that changed since the
+        // previous one (GETIMAGEDELTA), rebuilt in a buffer of the adapter.
+        // The command is tried when enabled (or at connect()), it stays off if
+        // the simulator does not answer it or answers it with an error.
+        void setDeltaTransport(bool enable);
+        const bool isDeltaTransport(){ return deltaTransport; }
+
+        // decode base64 (and jpeg when available) while the payload is received
+        void setStreamingDecode(bool enable){ streamingDecode = enable; }
+        const bool isStreamingDecode(){ return streamingDecode; }
 
         #ifdef WITH_OPENCV
             cv::Mat getImageOpenCV();
             cv::Mat getImageBWOpenCV();
+            // decode into the caller's storage, reused when size and type match
+            const bool getImageOpenCV(cv::Mat &);
         #endif
 
         #if defined(WITH_OPENCV) && defined(WITH_VISP)
             vpImage<unsigned char> getImageViSP();
             vpImage<unsigned char> getImageBWViSP();
-            vpMatrix get_eJe();
-            vpMatrix get_fJe();
-            vpHomogeneousMatrix get_fMe();
+            // luminance decoded straight into I, reused when the size matches
+            const bool getImageViSP(vpImage<unsigned char> &);
+            const bool getImageBWViSP(vpImage<unsigned char> &);
+            // grey windows around rects only (clipped to the image), written
+            // over the previous content of I. Gets the whole image when I is
+            // not at the image size yet, when no rect is inside the image, or
+            // if the simulator did not answer GETIMAGEROI at connect() or
+            // answers it with an error.
+            const bool getImageROI(vpImage<unsigned char> &, const std::vector<vpRect> &);
+
+            // background acquisition on a second connection: the newest frame
+            // is always available without waiting for the simulator
+            const bool startGrabber();
+            void stopGrabber();
+            const bool isGrabberRunning(){ return grabberAdapter != NULL; }
+            // copies the newest grabbed frame into I, false when it was already returned
+            const bool getLatestImageViSP(vpImage<unsigned char> &, vpVisaFrameInfo &);
+            unsigned long long getDroppedFrames() const { return droppedFrames; }
+            unsigned long long getDuplicatedFrames() const { return duplicatedFrames; }
         #endif
 
     private:
@@ -87,11 +313,166 @@ class vpVisaAdapter
             struct sockaddr_in server_socket;
         #endif
 
-        const bool sendCmd(std::string, std::vector<double>);
+        // reply to a binary request, filled by whichever thread receives it
+        struct PendingReply
+        {
+            unsigned short sequence;
+            bool done;
+            unsigned int size;
+            unsigned char data[vpVisaProtocol::MAX_DATAGRAM];
+        };
+        typedef std::chrono::steady_clock::time_point Deadline;
+        int receiveDatagram(unsigned char *, unsigned int, Deadline);
+        const bool exchangeBinary(unsigned char opcode, const double *, unsigned int, PendingReply &, bool retry);
+        const bool deliverBinary(const unsigned char *, unsigned int);
+        void beginText();
+        int receiveText(unsigned char *, unsigned int, Deadline);
+        int exchangeText(const char *, unsigned int, unsigned char *, unsigned int, bool retry);
+        int receivePayloadChunk(unsigned char *, unsigned int received, unsigned int size, Deadline);
+        // optional commands, tried once with a short deadline
+        static const int PROBE_TIMEOUT = 200; // ms
+        int probeText(const char * request, char * reply, unsigned int capacity);
+        void probeTick();
+        const bool probePayload(const char * request);
+        #if defined(WITH_OPENCV) && defined(WITH_VISP)
+            void probeRoi();
+        #endif
+        const bool receiveGrey(unsigned char *);
+
+        const bool tickRemote(const std::vector<double> & velocities, unsigned int request, vpVisaRobotState & state);
+        // false on a drift beyond kinematicsTolerance
+        const bool checkKinematics(unsigned int request, const vpVisaRobotState & state,
+                                   const std::vector<double> & fMe, const std::vector<double> & fJe);
+        const bool sendCmd(std::string, std::vector<double>, bool retry = true);
+        const bool query(const char *, std::vector<double> &, const std::vector<double> & args = std::vector<double>());
+        int requestPayload(const char *);
+        const bool receivePayload(unsigned char *, unsigned int);
+        // record: copy of the encoded image to the session log
+        const bool acquireEncodedImage(bool decodeJpeg = false, bool record = true);
+        const bool acquireEncodedImageStreaming(bool decodeJpeg, bool record);
+        void recordFrame(const vpVisaFrame &);
+        void countCopy(unsigned int bytes, unsigned int allocations);
+
+        // demultiplexing: one thread at a time reads the socket for all of them
+        std::mutex textMutex; // held for a whole text exchange or image transfer
+        std::mutex demuxMutex;
+        std::condition_variable demuxCondition;
+        bool receiving;
+        unsigned short nextSequence;
+        std::vector<PendingReply *> pendingReplies;
+        std::deque<std::vector<unsigned char> > textReplies; // received by a binary request
+        std::vector<unsigned char> demuxBuffer;
+
+        std::chrono::milliseconds timeout;
+        int retries;
+        struct
+        {
+            std::atomic<unsigned long long> requests, retries, timeouts, staleReplies;
+        } ioStats;
+        static thread_local vpVisaStatus lastStatus;
+
+        // times the outermost public call of the calling thread, the phases
+        // recorded meanwhile are attributed to its kind
+        class CallTimer
+        {
+            public:
+                CallTimer(vpVisaAdapter *, vpVisaCall);
+                ~CallTimer();
+            private:
+                vpVisaAdapter * adapter;
+                bool outermost;
+                std::chrono::steady_clock::time_point start;
+        };
+        void recordPhase(vpVisaPhase, std::chrono::steady_clock::time_point start);
+        void recordPhase(vpVisaPhase, std::chrono::steady_clock::duration);
+        vpVisaHistogram latency[VISA_CALL_COUNT][VISA_PHASE_COUNT];
+        std::atomic<long long> statsDumpPeriod; // ns
+        std::atomic<long long> nextStatsDump;   // steady_clock ns
+        static thread_local int callDepth;
+        static thread_local vpVisaCall currentCall;
+
+        vpVisaRecorder recorder;
+
+        std::vector<unsigned char> rxBuffer; // reused for every frame
+        unsigned int encodedSize; // size of the decoded payload at the start of rxBuffer
+        unsigned int imageWidth;
+        unsigned int imageHeight;
+        vpVisaFrameStats frameStats;
+        bool streamingDecode;
+        std::atomic<bool> deltaTransport;
+        std::vector<unsigned char> deltaImage; // last grey image of the delta transport
+        unsigned int deltaFrame; // its frame id, 0 for none
+        #ifdef WITH_JPEG
+            vpJpegStreamDecoder jpegDecoder;
+        #endif
+
+        #if defined(WITH_OPENCV) && defined(WITH_VISP)
+            struct GrabbedFrame
+            {
+                GrabbedFrame(){ info.sequence = 0; }
+                vpImage<unsigned char> I;
+                vpVisaFrameInfo info;
+            };
+            void grabberLoop();
+
+            vpVisaAdapter * grabberAdapter;
+            std::thread grabberThread;
+            std::atomic<bool> grabberRunning;
+            vpTripleBuffer<GrabbedFrame> grabbedFrames;
+            unsigned long long grabbedSequence; // written by the grabber thread only
+            unsigned long long lastSequence;
+            unsigned long long droppedFrames;
+            unsigned long long duplicatedFrames;
+        #endif
+
+        struct VelocityCommand
+        {
+            unsigned int count;
+            double values[MAX_STREAMED_JOINTS];
+        };
+        void velocityLoop();
+        // binary mode, the OK is matched by deliverBinary()
+        const bool sendVelocity(const std::vector<double> &);
+        // velocities in flight once the replies received are delivered and
+        // the failed ones reported
+        unsigned int collectVelocityReplies(std::vector<double> & failed);
+
+        vpSpscQueue<VelocityCommand, 64> velocityQueue;
+        std::thread velocityThread;
+        std::atomic<bool> velocityRunning;
+        std::mutex velocityMutex; // only for the streaming thread to sleep on
+        std::condition_variable velocityCondition;
+        vpVisaStreamCallback velocityFailed;
+        struct StreamedVelocity
+        {
+            unsigned short sequence;
+            vpVisaStatus status; // VISA_TIMEOUT until answered, VISA_ERROR when refused
+            Deadline deadline;
+            VelocityCommand command;
+        };
+        std::vector<StreamedVelocity> velocityInFlight; // under demuxMutex, at most VELOCITY_WINDOW
+        struct
+        {
+            std::atomic<unsigned long long> queued, sent, coalesced, failed, rejected;
+        } streamStats;
+
+        std::shared_ptr<vpVisaKinematicModel> kinematics;
+        unsigned int kinematicsCheckPeriod;
+        double kinematicsTolerance;
+        std::atomic<unsigned long long> kinematicsRequests;
+        std::mutex kinematicsMutex; // statistics
+        vpVisaKinematicsStats kinematicsStats;
+
+        vpVisaFrame acquireFrame();
+        std::shared_ptr<vpVisaFramePool> framePool;
+        unsigned int framePoolSize;
 
-        unsigned char * bufferImage;
-        unsigned char * bufferMsg;
+        std::string host;
+        unsigned int port;
         bool connected;
+        bool binaryProtocol;
+        std::atomic<bool> tickSupported;
+        std::atomic<bool> roiSupported;
         bool isVelCtrlActive; // not used yet
 };
 #endif // VISA_SOCKET_ADAPTER_H
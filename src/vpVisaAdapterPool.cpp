@@ -0,0 +1,297 @@
+#include "vpVisaAdapterPool.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+vpVisaAdapterPool::vpVisaAdapterPool()
+    : timeout(1000), epollFd(-1), wakeFd(-1), running(false), submitted(NULL), current(NULL),
+      remaining(0), buffer(vpVisaProtocol::MAX_DATAGRAM + 2048)
+{
+}
+
+vpVisaAdapterPool::~vpVisaAdapterPool()
+{
+    this->stop();
+}
+
+unsigned int vpVisaAdapterPool::add(const char * host, unsigned int port)
+{
+    Connection connection;
+    connection.host = host;
+    connection.port = port;
+    connection.sock = -1;
+    connection.binary = false;
+    connection.waiting = false;
+    connection.sequence = 0;
+    connection.status = VISA_OK;
+    connections.push_back(connection);
+    return connections.size() - 1;
+}
+
+const bool vpVisaAdapterPool::start(bool binary)
+{
+    if (running) return true;
+
+    epollFd = epoll_create1(0);
+    wakeFd = eventfd(0, EFD_NONBLOCK);
+    if (epollFd < 0 || wakeFd < 0){
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: cannot create the event loop (%s)", strerror(errno));
+        this->stop();
+        return false;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = connections.size(); // past the connections: the wake up
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+    for (unsigned int i = 0; i < connections.size(); i++){
+        Connection & connection = connections[i];
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = inet_addr(connection.host.c_str());
+        address.sin_port = htons(connection.port);
+
+        // connected: only the datagrams of its simulator reach the socket
+        connection.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (connection.sock < 0 || ::connect(connection.sock, (struct sockaddr *)&address, sizeof(address)) < 0){
+            VISA_LOG(VISA_LOG_ERROR, "ERROR: cannot open a socket to %s:%u", connection.host.c_str(), connection.port);
+            this->stop();
+            return false;
+        }
+        fcntl(connection.sock, F_SETFL, fcntl(connection.sock, F_GETFL, 0) | O_NONBLOCK);
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, connection.sock, &event);
+    }
+
+    running = true;
+    thread = std::thread(&vpVisaAdapterPool::loop, this);
+
+    if (binary){
+        // a simulator without binary support may not answer at all
+        Batch batch = { "SETPROTOCOL,BINARY", vpVisaProtocol::OP_NONE, false, NULL, NULL,
+                        std::chrono::milliseconds(200), false };
+        this->run(batch);
+        for (auto & connection : connections){
+            connection.binary = (connection.status == VISA_OK);
+            if (!connection.binary){
+                VISA_LOG(VISA_LOG_WARNING, "Binary protocol not supported by %s:%u, using text",
+                         connection.host.c_str(), connection.port);
+            }
+        }
+    }
+    return true;
+}
+
+void vpVisaAdapterPool::stop()
+{
+    if (running){
+        running = false;
+        uint64_t one = 1;
+        if (::write(wakeFd, &one, sizeof(one)) < 0) {}
+        thread.join();
+    }
+    for (auto & connection : connections){
+        if (connection.sock >= 0) close(connection.sock);
+        connection.sock = -1;
+        connection.binary = false;
+    }
+    if (wakeFd >= 0) close(wakeFd);
+    if (epollFd >= 0) close(epollFd);
+    wakeFd = epollFd = -1;
+}
+
+const bool vpVisaAdapterPool::query(const char * cmd, std::vector<std::vector<double> > & values,
+                                    const std::vector<std::vector<double> > & args)
+{
+    Batch batch = { cmd, vpVisaProtocol::opcode(cmd, strlen(cmd)), true, &args, &values, timeout, false };
+    return this->run(batch);
+}
+
+const bool vpVisaAdapterPool::command(const char * cmd, const std::vector<std::vector<double> > & args)
+{
+    Batch batch = { cmd, vpVisaProtocol::opcode(cmd, strlen(cmd)), false, &args, NULL, timeout, false };
+    return this->run(batch);
+}
+
+const bool vpVisaAdapterPool::run(Batch & batch)
+{
+    if (!running) return false;
+    if (batch.args && !batch.args->empty() && batch.args->size() != connections.size()){
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: %s: %zu arguments for %zu simulators", batch.cmd,
+                 batch.args->size(), connections.size());
+        return false;
+    }
+    if (batch.values) batch.values->resize(connections.size());
+
+    std::lock_guard<std::mutex> call(callMutex);
+    std::unique_lock<std::mutex> lock(batchMutex);
+    submitted = &batch;
+    uint64_t one = 1;
+    if (::write(wakeFd, &one, sizeof(one)) < 0) {}
+    batchCondition.wait(lock, [&batch]{ return batch.done; });
+
+    bool ok = true;
+    for (const auto & connection : connections) ok = ok && connection.status == VISA_OK;
+    return ok;
+}
+
+// =============================================================================
+// EVENT LOOP
+// =============================================================================
+
+void vpVisaAdapterPool::loop()
+{
+    std::vector<struct epoll_event> events(connections.size() + 1);
+    while (running){
+        int wait = -1;
+        if (current != NULL){
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+            wait = (int)std::max<long long>(0, left + 1);
+        }
+
+        int n = epoll_wait(epollFd, events.data(), events.size(), wait);
+        if (n < 0 && errno != EINTR) break;
+        for (int k = 0; k < n; k++){
+            unsigned int i = events[k].data.u32;
+            if (i < connections.size()){
+                this->receive(i);
+                continue;
+            }
+            uint64_t count;
+            if (::read(wakeFd, &count, sizeof(count)) < 0) {}
+            if (current == NULL){
+                {
+                    std::lock_guard<std::mutex> lock(batchMutex);
+                    std::swap(current, submitted);
+                }
+                // outside the lock: complete() takes it when every send fails
+                if (current) this->send(*current);
+            }
+        }
+
+        if (current != NULL && std::chrono::steady_clock::now() >= deadline){
+            for (unsigned int i = 0; i < connections.size(); i++){
+                if (connections[i].waiting) this->complete(i, VISA_TIMEOUT);
+            }
+        }
+    }
+
+    // a batch in flight is abandoned
+    std::lock_guard<std::mutex> lock(batchMutex);
+    Batch * pending[] = { current, submitted };
+    for (auto batch : pending){
+        if (batch == NULL) continue;
+        for (auto & connection : connections){
+            if (connection.waiting || batch == submitted) connection.status = VISA_ERROR;
+            connection.waiting = false;
+        }
+        batch->done = true;
+    }
+    current = submitted = NULL;
+    batchCondition.notify_all();
+}
+
+void vpVisaAdapterPool::send(Batch & batch)
+{
+    deadline = std::chrono::steady_clock::now() + batch.timeout;
+    remaining = connections.size();
+
+    unsigned char datagram[vpVisaProtocol::MAX_DATAGRAM];
+    std::string text;
+    for (unsigned int i = 0; i < connections.size(); i++){
+        Connection & connection = connections[i];
+        // late answers to a previous batch
+        while (::recv(connection.sock, buffer.data(), buffer.size(), 0) > 0) {}
+
+        static const std::vector<double> none;
+        const std::vector<double> & args = (batch.args && !batch.args->empty()) ? (*batch.args)[i] : none;
+        connection.waiting = true;
+        connection.status = VISA_OK;
+
+        ssize_t sent;
+        if (connection.binary && batch.opcode != vpVisaProtocol::OP_NONE){
+            if (++connection.sequence == 0) ++connection.sequence;
+            unsigned int size = vpVisaProtocol::encode(datagram, sizeof(datagram), batch.opcode,
+                                                       args.data(), args.size(), connection.sequence);
+            sent = size ? ::send(connection.sock, datagram, size, 0) : -1;
+        }
+        else{
+            text = batch.cmd;
+            for (auto value : args){
+                char number[32];
+                snprintf(number, sizeof(number), ",%.17g", value);
+                text += number;
+            }
+            sent = ::send(connection.sock, text.data(), text.size(), 0);
+        }
+        if (sent < 0) this->complete(i, VISA_ERROR);
+    }
+}
+
+void vpVisaAdapterPool::receive(unsigned int i)
+{
+    Connection & connection = connections[i];
+    while (true){
+        ssize_t n = ::recv(connection.sock, buffer.data(), buffer.size() - 1, 0);
+        if (n <= 0) return;
+        if (current == NULL || !connection.waiting) continue; // stale
+
+        std::vector<double> * values = current->values ? &(*current->values)[i] : NULL;
+        vpVisaProtocol::Header header;
+        const unsigned char * data;
+        if (vpVisaProtocol::decode(buffer.data(), n, header, data)){
+            if (header.sequence != connection.sequence) continue; // answer to an abandoned request
+            bool ok = header.opcode == (current->expectValues ? vpVisaProtocol::OP_VALUES : vpVisaProtocol::OP_OK);
+            if (ok && values){
+                values->resize(header.count);
+                for (unsigned int k = 0; k < header.count; k++) (*values)[k] = vpVisaProtocol::readDouble(data + 8 * k);
+            }
+            this->complete(i, ok ? VISA_OK : VISA_ERROR);
+            continue;
+        }
+
+        const char * text = (const char *)buffer.data();
+        buffer[n] = '\0';
+        bool ok = strncmp(text, "ERROR", 5) != 0;
+        if (ok && values){
+            double parsed[vpVisaProtocol::MAX_VALUES];
+            int count = vpVisaProtocol::parseText(text, n, parsed, vpVisaProtocol::MAX_VALUES);
+            ok = count >= 0;
+            values->assign(parsed, parsed + std::max(count, 0));
+        }
+        else if (ok){
+            ok = strncmp(text, "OK", 2) == 0;
+        }
+        if (!ok) VISA_LOG(VISA_LOG_ERROR, "ERROR: %s on %s:%u: %s", current->cmd, connection.host.c_str(), connection.port, text);
+        this->complete(i, ok ? VISA_OK : VISA_ERROR);
+    }
+}
+
+void vpVisaAdapterPool::complete(unsigned int i, vpVisaStatus status)
+{
+    Connection & connection = connections[i];
+    if (!connection.waiting) return;
+    connection.waiting = false;
+    connection.status = status;
+    if (status == VISA_TIMEOUT && current->timeout == timeout){
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: %s timed out on %s:%u", current->cmd, connection.host.c_str(), connection.port);
+    }
+    if (--remaining > 0) return;
+
+    std::lock_guard<std::mutex> lock(batchMutex);
+    current->done = true;
+    current = NULL;
+    batchCondition.notify_all();
+}
+
+#endif // __linux__
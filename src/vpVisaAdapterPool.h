@@ -0,0 +1,102 @@
+#ifndef VP_VISA_ADAPTER_POOL_H
+#define VP_VISA_ADAPTER_POOL_H
+
+#ifdef __linux__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <netinet/in.h>
+
+#include "vpVisaAdapter.h"
+
+// Connections to many simulators, all served by one epoll event loop thread.
+//
+// A batched call sends the same request to every simulator at once (each
+// with its own arguments) and returns when every reply is in or the timeout
+// has elapsed. Numeric queries and commands only, in binary where the
+// simulator accepts it, in text otherwise. Calls from several threads are
+// served one batch after the other. Linux only.
+class vpVisaAdapterPool
+{
+    public:
+        vpVisaAdapterPool();
+        ~vpVisaAdapterPool();
+
+        // before start(), returns the index of the simulator in the batches
+        unsigned int add(const char * host = "127.0.0.1", unsigned int port = 2408);
+        // opens the sockets, starts the loop thread and negotiates the binary
+        // protocol with every simulator (text everywhere if binary is false)
+        const bool start(bool binary = true);
+        void stop();
+
+        unsigned int size() const { return connections.size(); }
+        // deadline of a batch, 1000 ms by default. Nothing is sent again.
+        void setTimeout(unsigned int ms){ timeout = std::chrono::milliseconds(ms); }
+        const bool isBinaryProtocol(unsigned int i) const { return connections[i].binary; }
+        // outcome for simulator i of the last batch
+        vpVisaStatus getStatus(unsigned int i) const { return connections[i].status; }
+
+        // true when every simulator answered (see getStatus() otherwise)
+        const bool getJointPos(std::vector<std::vector<double> > & values){ return this->query("GETJOINTPOS", values); }
+        const bool getToolTransform(std::vector<std::vector<double> > & values){ return this->query("GETTOOLPOS", values); }
+        const bool setJointVel(const std::vector<std::vector<double> > & velocities){ return this->command("SETJOINTVEL", velocities); }
+        const bool query(const char * cmd, std::vector<std::vector<double> > & values,
+                         const std::vector<std::vector<double> > & args = std::vector<std::vector<double> >());
+        // args[i] for simulator i, none for all if args is empty
+        const bool command(const char * cmd, const std::vector<std::vector<double> > & args);
+
+    private:
+        struct Connection
+        {
+            std::string host;
+            unsigned int port;
+            int sock;
+            bool binary;
+            bool waiting; // for the reply to the current batch
+            unsigned short sequence;
+            vpVisaStatus status;
+        };
+        struct Batch
+        {
+            const char * cmd;
+            unsigned char opcode;
+            bool expectValues;
+            const std::vector<std::vector<double> > * args;
+            std::vector<std::vector<double> > * values; // NULL for a command
+            std::chrono::milliseconds timeout;
+            bool done;
+        };
+
+        const bool run(Batch &);
+        void loop();
+        void send(Batch &);
+        void receive(unsigned int connection);
+        void complete(unsigned int connection, vpVisaStatus);
+
+        std::vector<Connection> connections;
+        std::chrono::milliseconds timeout;
+
+        int epollFd;
+        int wakeFd; // eventfd, a batch was submitted or stop() was called
+        std::thread thread;
+        std::atomic<bool> running;
+
+        std::mutex callMutex; // one batch at a time
+        std::mutex batchMutex;
+        std::condition_variable batchCondition;
+        Batch * submitted; // handed to the loop
+        Batch * current;   // owned by the loop
+        unsigned int remaining;
+        std::chrono::steady_clock::time_point deadline;
+        std::vector<unsigned char> buffer;
+};
+
+#endif // __linux__
+
+#endif // VP_VISA_ADAPTER_POOL_H
@@ -0,0 +1,105 @@
+#include "vpVisaBackend.h"
+#include "vpVisaFixedKinematics.h"
+
+#include <cmath>
+
+const bool vpVisaBackend::unpackTick(unsigned int request, const std::vector<double> & values, vpVisaRobotState & state)
+{
+    std::vector<double> * quantities[] = { &state.jointPos, &state.toolPos, &state.jacobian };
+    size_t offset = 0;
+    state.mask = 0;
+    for (int i = 0; i < 3; i++){
+        if (!(request & (1 << i)) || offset >= values.size()) continue;
+        // a whole number of the values left, checked before the cast
+        double length = values[offset++];
+        if (!(length >= 0 && length <= values.size() - offset) || length != floor(length)) return false;
+        size_t count = (size_t)length;
+        quantities[i]->assign(values.begin() + offset, values.begin() + offset + count);
+        offset += count;
+        state.mask |= 1 << i;
+    }
+    return state.mask == request;
+}
+
+#if defined(WITH_OPENCV) && defined(WITH_VISP)
+vpMatrix vpVisaBackend::get_fJe()
+{
+    vpVisaRobotState state;
+    this->getJacobian(state.jacobian);
+    return get_fJe(state);
+}
+
+vpHomogeneousMatrix vpVisaBackend::get_fMe(){
+    vpVisaRobotState state;
+    this->getToolTransform(state.toolPos);
+    return get_fMe(state);
+}
+
+vpMatrix vpVisaBackend::get_eJe()
+{
+    // both quantities in a single round trip
+    vpVisaRobotState state;
+    this->tick({}, VISA_STATE_TOOLPOS | VISA_STATE_JACOBIAN, state);
+    return get_eJe(state);
+}
+
+vpMatrix vpVisaBackend::get_fJe(const vpVisaRobotState & state)
+{
+    const std::vector<double> & values = state.jacobian;
+
+    vpMatrix J;
+    int nbDOFs = values.size() / 6;
+    J = vpMatrix(6, nbDOFs);
+    for (int i = 0; i < 6; i++){
+        for (int j = 0; j < nbDOFs; j++){
+            J[i][j] = values[nbDOFs*i + j];
+        }        
+    }
+    return J;
+}
+
+vpHomogeneousMatrix vpVisaBackend::get_fMe(const vpVisaRobotState & state){
+    const std::vector<double> & fMe_vector = state.toolPos;
+
+    vpHomogeneousMatrix fMe;
+    if (fMe_vector.size() < 16) return fMe;
+    for (int i = 0; i < 4; i++){
+        for (int j = 0; j < 4; j++){
+            fMe[i][j] = fMe_vector[4*j+i];
+        }   
+    }
+    return fMe;
+}
+
+// eJe = blockdiag(eRf, eRf) * fJe, for an arm of N joints
+template <unsigned int N>
+static const bool fixed_eJe(const vpVisaRobotState & state, vpMatrix & eJe)
+{
+    vpVisaPose fMe;
+    typename vpVisaFixedKinematics<N>::Jacobian fJe, J;
+    if (!vpVisaFixedKinematics<N>::fromState(state, fMe, fJe)) return false;
+    vpVisaFixedKinematics<N>::get_eJe(fMe, fJe, J);
+    J.toViSP(eJe);
+    return true;
+}
+
+vpMatrix vpVisaBackend::get_eJe(const vpVisaRobotState & state)
+{
+    // the usual arms without intermediate matrices
+    vpMatrix eJe;
+    if (fixed_eJe<6>(state, eJe) || fixed_eJe<7>(state, eJe)) return eJe;
+
+    vpMatrix fJe = get_fJe(state);
+    vpVisaPose fMe;
+    fMe.fromViSP(get_fMe(state));
+    eJe.resize(6, fJe.getCols());
+    for (unsigned int block = 0; block < 6; block += 3){
+        for (unsigned int i = 0; i < 3; i++){
+            for (unsigned int j = 0; j < fJe.getCols(); j++){
+                eJe[block+i][j] = fMe.R(0, i) * fJe[block][j] + fMe.R(1, i) * fJe[block+1][j] + fMe.R(2, i) * fJe[block+2][j];
+            }
+        }
+    }
+    return eJe;
+}
+#endif // WITH_OPENCV && WITH_VISP
@@ -0,0 +1,81 @@
+#ifndef VP_VISA_BACKEND_H
+#define VP_VISA_BACKEND_H
+
+#include <stddef.h>
+#include <vector>
+
+#ifdef WITH_OPENCV
+#include <opencv2/opencv.hpp>
+#endif
+
+#ifdef WITH_VISP
+#include <visp3/io/vpImageIo.h>
+#include <visp3/core/vpRect.h>
+#endif
+
+// State read by vpVisaBackend::tick()
+enum vpVisaStateRequest
+{
+    VISA_STATE_NONE     = 0,
+    VISA_STATE_JOINTPOS = 1, // as getJointPos()
+    VISA_STATE_TOOLPOS  = 2, // as getToolTransform()
+    VISA_STATE_JACOBIAN = 4, // fJe, 6xN row major
+    VISA_STATE_ALL      = 7
+};
+
+struct vpVisaRobotState
+{
+    unsigned int mask; // quantities filled by the last tick()
+    std::vector<double> jointPos;
+    std::vector<double> toolPos;
+    std::vector<double> jacobian;
+};
+
+// The robot and camera as seen by the control code: the simulator itself
+// (vpVisaAdapter) or a recorded session (vpVisaReplay).
+class vpVisaBackend
+{
+    public:
+        virtual ~vpVisaBackend() {}
+
+        virtual const bool setJointPosAbs(std::vector<double>) = 0;
+        virtual const bool setJointPosRel(std::vector<double>) = 0;
+        virtual const bool setJointVel(std::vector<double>) = 0;
+        virtual const bool homing() = 0;
+
+        virtual void getJointPos(std::vector<double> &) = 0;
+        virtual void getToolTransform(std::vector<double> &) = 0;
+        virtual void getCalibMatrix(std::vector<double> &) = 0;
+        // fJe, 6xN row major
+        virtual void getJacobian(std::vector<double> &) = 0;
+
+        // applies the joint velocities (none if empty) then reads the
+        // requested state (vpVisaStateRequest mask)
+        virtual const bool tick(const std::vector<double> & velocities, unsigned int request, vpVisaRobotState & state) = 0;
+
+        // encoded image (jpeg or png), data valid until the next image request,
+        // NULL and 0 on failure
+        virtual const bool getImage(const unsigned char * & data, unsigned int & size) = 0;
+
+        #if defined(WITH_OPENCV) && defined(WITH_VISP)
+            virtual const bool getImageViSP(vpImage<unsigned char> &) = 0;
+            virtual const bool getImageBWViSP(vpImage<unsigned char> &) = 0;
+            virtual const bool getImageROI(vpImage<unsigned char> &, const std::vector<vpRect> &) = 0;
+
+            vpMatrix get_eJe();
+            vpMatrix get_fJe();
+            vpHomogeneousMatrix get_fMe();
+            // same from the state returned by tick()
+            static vpMatrix get_eJe(const vpVisaRobotState &);
+            static vpMatrix get_fJe(const vpVisaRobotState &);
+            static vpHomogeneousMatrix get_fMe(const vpVisaRobotState &);
+        #endif
+
+    protected:
+        // TICK reply: each requested quantity, in bit order, as its number of
+        // values then the values. False if one of them is missing or its
+        // number of values is not a count of the values left.
+        static const bool unpackTick(unsigned int request, const std::vector<double> & values, vpVisaRobotState & state);
+};
+
+#endif // VP_VISA_BACKEND_H
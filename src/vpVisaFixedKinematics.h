@@ -0,0 +1,224 @@
+#ifndef VP_VISA_FIXED_KINEMATICS_H
+#define VP_VISA_FIXED_KINEMATICS_H
+
+#include <math.h>
+#include <string.h>
+
+#include "vpVisaBackend.h"
+
+// Kinematics of the control loop with sizes known at compile time: storage
+// on the stack, loops the compiler unrolls, nothing allocated. Matrices are
+// row major.
+
+template <unsigned int R, unsigned int C>
+struct vpVisaMat
+{
+    alignas(32) double data[R * C];
+
+    double & operator()(unsigned int i, unsigned int j){ return data[C * i + j]; }
+    const double & operator()(unsigned int i, unsigned int j) const { return data[C * i + j]; }
+    void setZero(){ memset(data, 0, sizeof(data)); }
+
+    template <unsigned int K>
+    void multiply(const vpVisaMat<R, K> & A, const vpVisaMat<K, C> & B)
+    {
+        // this = A * B, neither of them being this
+        for (unsigned int i = 0; i < R; i++){
+            double * row = data + C * i;
+            for (unsigned int j = 0; j < C; j++) row[j] = 0;
+            for (unsigned int k = 0; k < K; k++){
+                const double a = A(i, k);
+                const double * b = B.data + C * k;
+                for (unsigned int j = 0; j < C; j++) row[j] += a * b[j];
+            }
+        }
+    }
+
+    void transpose(const vpVisaMat<C, R> & A)
+    {
+        for (unsigned int i = 0; i < R; i++){
+            for (unsigned int j = 0; j < C; j++) data[C * i + j] = A(j, i);
+        }
+    }
+
+    #ifdef WITH_VISP
+        void toViSP(vpMatrix & M) const
+        {
+            if (M.getRows() != R || M.getCols() != C) M.resize(R, C, false);
+            memcpy(M.data, data, sizeof(data));
+        }
+        const bool fromViSP(const vpMatrix & M)
+        {
+            if (M.getRows() != R || M.getCols() != C) return false;
+            memcpy(data, M.data, sizeof(data));
+            return true;
+        }
+    #endif
+};
+
+typedef vpVisaMat<3, 3> vpVisaRotation;
+typedef vpVisaMat<6, 6> vpVisaTwist;
+
+// rigid transformation aMb
+struct vpVisaPose
+{
+    vpVisaRotation R;
+    double t[3];
+
+    // 16 values column major, as GETTOOLPOS
+    void fromColumnMajor(const double * M)
+    {
+        for (int i = 0; i < 3; i++){
+            for (int j = 0; j < 3; j++) R(i, j) = M[4*j+i];
+            t[i] = M[12+i];
+        }
+    }
+
+    // bMa
+    vpVisaPose inverse() const
+    {
+        vpVisaPose inverse;
+        inverse.R.transpose(R);
+        for (int i = 0; i < 3; i++){
+            inverse.t[i] = -(R(0, i) * t[0] + R(1, i) * t[1] + R(2, i) * t[2]);
+        }
+        return inverse;
+    }
+
+    // aVb, as vpVelocityTwistMatrix: [R [t]x R; 0 R]
+    void twist(vpVisaTwist & V) const
+    {
+        const double skew[3][3] = { {0, -t[2], t[1]}, {t[2], 0, -t[0]}, {-t[1], t[0], 0} };
+        V.setZero();
+        for (int i = 0; i < 3; i++){
+            for (int j = 0; j < 3; j++){
+                V(i, j) = V(i+3, j+3) = R(i, j);
+                V(i, j+3) = skew[i][0] * R(0, j) + skew[i][1] * R(1, j) + skew[i][2] * R(2, j);
+            }
+        }
+    }
+
+    #ifdef WITH_VISP
+        void toViSP(vpHomogeneousMatrix & M) const
+        {
+            for (int i = 0; i < 3; i++){
+                for (int j = 0; j < 3; j++) M[i][j] = R(i, j);
+                M[i][3] = t[i];
+            }
+        }
+        void fromViSP(const vpHomogeneousMatrix & M)
+        {
+            for (int i = 0; i < 3; i++){
+                for (int j = 0; j < 3; j++) R(i, j) = M[i][j];
+                t[i] = M[i][3];
+            }
+        }
+    #endif
+};
+
+// Jacobians of an arm of N joints: 6xN, translational velocity rows first
+template <unsigned int N>
+class vpVisaFixedKinematics
+{
+    public:
+        typedef vpVisaMat<6, N> Jacobian;
+        typedef vpVisaMat<N, 6> JacobianInverse;
+
+        // fMe and fJe from a tick() state, false if their sizes do not match
+        static const bool fromState(const vpVisaRobotState & state, vpVisaPose & fMe, Jacobian & fJe)
+        {
+            if (state.toolPos.size() != 16 || state.jacobian.size() != 6 * N) return false;
+            fMe.fromColumnMajor(state.toolPos.data());
+            memcpy(fJe.data, state.jacobian.data(), sizeof(fJe.data));
+            return true;
+        }
+
+        // J, expressed at the same point, in a frame rotated by aRb:
+        // blockdiag(aRb, aRb) * J
+        static void changeFrame(const vpVisaRotation & aRb, const Jacobian & bJ, Jacobian & aJ)
+        {
+            for (unsigned int block = 0; block < 6; block += 3){
+                for (unsigned int i = 0; i < 3; i++){
+                    for (unsigned int j = 0; j < N; j++){
+                        aJ(block+i, j) = aRb(i, 0) * bJ(block, j) + aRb(i, 1) * bJ(block+1, j) + aRb(i, 2) * bJ(block+2, j);
+                    }
+                }
+            }
+        }
+
+        // eJe = blockdiag(eRf, eRf) * fJe
+        static void get_eJe(const vpVisaPose & fMe, const Jacobian & fJe, Jacobian & eJe)
+        {
+            vpVisaRotation eRf;
+            eRf.transpose(fMe.R);
+            changeFrame(eRf, fJe, eJe);
+        }
+
+        // Damped least squares pseudo-inverse, J^T (J J^T + damping^2 I)^-1,
+        // through the smaller of J J^T and J^T J. With no damping J must have
+        // full rank. False if the system cannot be solved, Jp is then zero.
+        static const bool pseudoInverse(const Jacobian & J, JacobianInverse & Jp, double damping = 0)
+        {
+            JacobianInverse Jt;
+            Jt.transpose(J);
+            if (N >= 6){
+                vpVisaMat<6, 6> A;
+                A.multiply(J, Jt);
+                for (unsigned int i = 0; i < 6; i++) A(i, i) += damping * damping;
+                if (!invertSymmetric(A)){
+                    Jp.setZero();
+                    return false;
+                }
+                Jp.multiply(Jt, A);
+            }
+            else{
+                vpVisaMat<N, N> A;
+                A.multiply(Jt, J);
+                for (unsigned int i = 0; i < N; i++) A(i, i) += damping * damping;
+                if (!invertSymmetric(A)){
+                    Jp.setZero();
+                    return false;
+                }
+                Jp.multiply(A, Jt);
+            }
+            return true;
+        }
+
+    private:
+        // in place, by Cholesky decomposition, A symmetric positive definite
+        template <unsigned int M>
+        static const bool invertSymmetric(vpVisaMat<M, M> & A)
+        {
+            // A = L L^T, L in the lower triangle
+            vpVisaMat<M, M> L;
+            L.setZero();
+            for (unsigned int j = 0; j < M; j++){
+                double d = A(j, j);
+                for (unsigned int k = 0; k < j; k++) d -= L(j, k) * L(j, k);
+                if (!(d > 1e-15)) return false;
+                L(j, j) = sqrt(d);
+                for (unsigned int i = j + 1; i < M; i++){
+                    double s = A(i, j);
+                    for (unsigned int k = 0; k < j; k++) s -= L(i, k) * L(j, k);
+                    L(i, j) = s / L(j, j);
+                }
+            }
+            // A^-1 = L^-T L^-1, column by column of the identity
+            for (unsigned int c = 0; c < M; c++){
+                double y[M];
+                for (unsigned int i = 0; i < M; i++){
+                    double s = (i == c) ? 1.0 : 0.0;
+                    for (unsigned int k = 0; k < i; k++) s -= L(i, k) * y[k];
+                    y[i] = s / L(i, i);
+                }
+                for (int i = M - 1; i >= 0; i--){
+                    double s = y[i];
+                    for (unsigned int k = i + 1; k < M; k++) s -= L(k, i) * A(k, c);
+                    A(i, c) = s / L(i, i);
+                }
+            }
+            return true;
+        }
+};
+
+#endif // VP_VISA_FIXED_KINEMATICS_H
@@ -0,0 +1,103 @@
+#include "vpVisaFramePool.h"
+
+// =============================================================================
+// FRAME
+// =============================================================================
+
+vpVisaFrame::vpVisaFrame(const vpVisaFrame & other)
+    : pool(other.pool), slot(other.slot)
+{
+    if (slot) slot->references.fetch_add(1, std::memory_order_relaxed);
+}
+
+vpVisaFrame & vpVisaFrame::operator=(const vpVisaFrame & other)
+{
+    if (slot != other.slot){
+        if (other.slot) other.slot->references.fetch_add(1, std::memory_order_relaxed);
+        this->release();
+        pool = other.pool;
+        slot = other.slot;
+    }
+    return *this;
+}
+
+void vpVisaFrame::release()
+{
+    if (slot == NULL) return;
+    if (slot->references.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        pool->recycle(slot);
+    }
+    slot = NULL;
+    pool.reset();
+}
+
+unsigned char * vpVisaFrame::data(){ return slot ? slot->data : NULL; }
+const unsigned char * vpVisaFrame::data() const { return slot ? slot->data : NULL; }
+unsigned int vpVisaFrame::size() const { return slot ? slot->size : 0; }
+unsigned int vpVisaFrame::capacity() const { return slot ? pool->getFrameSize() : 0; }
+unsigned int vpVisaFrame::getWidth() const { return slot ? slot->width : 0; }
+unsigned int vpVisaFrame::getHeight() const { return slot ? slot->height : 0; }
+int vpVisaFrame::useCount() const { return slot ? slot->references.load() : 0; }
+
+void vpVisaFrame::setSize(unsigned int size)
+{
+    if (slot) slot->size = size;
+}
+
+void vpVisaFrame::setImageSize(unsigned int width, unsigned int height)
+{
+    if (slot == NULL) return;
+    slot->width = width;
+    slot->height = height;
+    slot->size = width * height;
+}
+
+#ifdef WITH_OPENCV
+cv::Mat vpVisaFrame::toOpenCV() const
+{
+    if (slot == NULL || slot->width == 0) return cv::Mat();
+    return cv::Mat(slot->height, slot->width, CV_8UC1, slot->data);
+}
+#endif
+
+// =============================================================================
+// POOL
+// =============================================================================
+
+vpVisaFramePool::vpVisaFramePool(unsigned int frames, unsigned int frameSize)
+    : frameSize(frameSize), memory((size_t)frames * frameSize), slots(frames)
+{
+    freeSlots.reserve(frames);
+    for (unsigned int i = 0; i < frames; i++){
+        slots[i].references = 0;
+        slots[i].data = memory.data() + (size_t)i * frameSize;
+        slots[i].size = slots[i].width = slots[i].height = 0;
+        freeSlots.push_back(&slots[i]);
+    }
+}
+
+vpVisaFrame vpVisaFramePool::acquire()
+{
+    vpVisaFrame frame;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freeSlots.empty()) return frame;
+
+    frame.slot = freeSlots.back();
+    freeSlots.pop_back();
+    frame.slot->references = 1;
+    frame.slot->size = frame.slot->width = frame.slot->height = 0;
+    frame.pool = shared_from_this();
+    return frame;
+}
+
+unsigned int vpVisaFramePool::getFreeCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return freeSlots.size();
+}
+
+void vpVisaFramePool::recycle(vpVisaFrame::Slot * slot)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    freeSlots.push_back(slot);
+}
@@ -0,0 +1,89 @@
+#ifndef VP_VISA_FRAME_POOL_H
+#define VP_VISA_FRAME_POOL_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef WITH_OPENCV
+#include <opencv2/opencv.hpp>
+#endif
+
+class vpVisaFramePool;
+
+// Reference counted handle on a frame of a vpVisaFramePool.
+//
+// Copies share the frame, which goes back to the pool when the last handle
+// is released or destroyed. The pool itself lives as long as one of its
+// frames is held.
+class vpVisaFrame
+{
+    public:
+        vpVisaFrame() : slot(NULL) {}
+        vpVisaFrame(const vpVisaFrame & other);
+        vpVisaFrame & operator=(const vpVisaFrame & other);
+        ~vpVisaFrame(){ release(); }
+
+        void release();
+        const bool empty() const { return slot == NULL; }
+
+        unsigned char * data();
+        const unsigned char * data() const;
+        unsigned int size() const;     // bytes in use
+        unsigned int capacity() const; // bytes available
+        unsigned int getWidth() const;  // 0 for an encoded image
+        unsigned int getHeight() const;
+        // number of handles sharing the frame
+        int useCount() const;
+
+        // filled by the producer of the frame
+        void setSize(unsigned int size);
+        void setImageSize(unsigned int width, unsigned int height);
+
+        #ifdef WITH_OPENCV
+            // grey image header on the frame, valid while the frame is held
+            cv::Mat toOpenCV() const;
+        #endif
+
+    private:
+        friend class vpVisaFramePool;
+        struct Slot
+        {
+            std::atomic<int> references;
+            unsigned char * data;
+            unsigned int size;
+            unsigned int width;
+            unsigned int height;
+        };
+
+        std::shared_ptr<vpVisaFramePool> pool;
+        Slot * slot;
+};
+
+// Fixed set of equally sized frames, allocated once. Taking and returning a
+// frame never allocates, from any thread.
+class vpVisaFramePool : public std::enable_shared_from_this<vpVisaFramePool>
+{
+    public:
+        vpVisaFramePool(unsigned int frames, unsigned int frameSize);
+
+        // a free frame, empty when all of them are held
+        vpVisaFrame acquire();
+
+        unsigned int getFrameCount() const { return slots.size(); }
+        unsigned int getFrameSize() const { return frameSize; }
+        unsigned int getFreeCount();
+
+    private:
+        friend class vpVisaFrame;
+        void recycle(vpVisaFrame::Slot *);
+
+        unsigned int frameSize;
+        std::vector<unsigned char> memory;
+        std::vector<vpVisaFrame::Slot> slots;
+        std::vector<vpVisaFrame::Slot *> freeSlots; // never grows past slots.size()
+        std::mutex mutex;
+};
+
+#endif // VP_VISA_FRAME_POOL_H
@@ -0,0 +1,80 @@
+#include "vpVisaKinematics.h"
+
+#include <math.h>
+
+// 4x4 homogeneous matrices, column major as on the wire
+static void identity(double * M)
+{
+    for (int k = 0; k < 16; k++) M[k] = (k % 5 == 0) ? 1.0 : 0.0;
+}
+
+static void multiply(const double * A, const double * B, double * C)
+{
+    double R[16];
+    for (int i = 0; i < 4; i++){
+        for (int j = 0; j < 4; j++){
+            R[4*j+i] = A[i] * B[4*j] + A[4+i] * B[4*j+1] + A[8+i] * B[4*j+2] + A[12+i] * B[4*j+3];
+        }
+    }
+    for (int k = 0; k < 16; k++) C[k] = R[k];
+}
+
+vpVisaDhModel::vpVisaDhModel()
+    : base(16), tool(16)
+{
+    identity(base.data());
+    identity(tool.data());
+}
+
+void vpVisaDhModel::addJoint(JointType type, double theta, double d, double a, double alpha)
+{
+    Joint joint = { type, theta, d, a, alpha };
+    joints.push_back(joint);
+}
+
+void vpVisaDhModel::compute(const std::vector<double> & q, std::vector<double> & fMe, std::vector<double> & fJe) const
+{
+    const size_t n = joints.size();
+    // axis (z) and origin of frame i-1 for every joint i, in the base frame
+    std::vector<double> axes(3 * n), origins(3 * n);
+
+    double M[16];
+    for (int k = 0; k < 16; k++) M[k] = base[k];
+    for (size_t i = 0; i < n; i++){
+        for (int k = 0; k < 3; k++){
+            axes[3*i+k] = M[8+k];
+            origins[3*i+k] = M[12+k];
+        }
+
+        const Joint & joint = joints[i];
+        double value = i < q.size() ? q[i] : 0.0;
+        double theta = joint.theta + (joint.type == REVOLUTE ? value : 0.0);
+        double d = joint.d + (joint.type == PRISMATIC ? value : 0.0);
+        double ct = cos(theta), st = sin(theta), ca = cos(joint.alpha), sa = sin(joint.alpha);
+        const double T[16] = {
+            ct,               st,               0,  0,
+            -st * ca,         ct * ca,          sa, 0,
+            st * sa,          -ct * sa,         ca, 0,
+            joint.a * ct,     joint.a * st,     d,  1
+        };
+        multiply(M, T, M);
+    }
+    multiply(M, tool.data(), M);
+    fMe.assign(M, M + 16);
+
+    // geometric jacobian at the origin of the end-effector frame
+    fJe.assign(6 * n, 0.0);
+    for (size_t i = 0; i < n; i++){
+        const double * z = &axes[3*i];
+        if (joints[i].type == PRISMATIC){
+            for (int k = 0; k < 3; k++) fJe[n*k + i] = z[k];
+            continue;
+        }
+        double r[3];
+        for (int k = 0; k < 3; k++) r[k] = M[12+k] - origins[3*i+k];
+        fJe[i]       = z[1] * r[2] - z[2] * r[1];
+        fJe[n + i]   = z[2] * r[0] - z[0] * r[2];
+        fJe[2*n + i] = z[0] * r[1] - z[1] * r[0];
+        for (int k = 0; k < 3; k++) fJe[n*(3+k) + i] = z[k];
+    }
+}
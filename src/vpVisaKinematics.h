@@ -0,0 +1,83 @@
+#ifndef VP_VISA_KINEMATICS_H
+#define VP_VISA_KINEMATICS_H
+
+#include <vector>
+
+#ifdef WITH_VISP
+#include <visp3/core/vpColVector.h>
+#include <visp3/core/vpHomogeneousMatrix.h>
+#include <visp3/core/vpMatrix.h>
+#endif
+
+// Forward kinematics of the simulated arm, in the layout of the simulator
+// replies: fMe as 16 values column major (GETTOOLPOS), fJe as 6xN row major,
+// translational velocity rows first (GETJACOBIAN).
+class vpVisaKinematicModel
+{
+    public:
+        virtual ~vpVisaKinematicModel() {}
+        virtual void compute(const std::vector<double> & q, std::vector<double> & fMe, std::vector<double> & fJe) const = 0;
+};
+
+// Standard Denavit-Hartenberg table, joint i moving frame i-1 to frame i
+// by Rz(theta) Tz(d) Tx(a) Rx(alpha)
+class vpVisaDhModel : public vpVisaKinematicModel
+{
+    public:
+        enum JointType { REVOLUTE, PRISMATIC };
+
+        vpVisaDhModel();
+
+        // theta (rad) or d (m) is an offset added to the joint position
+        void addJoint(JointType type, double theta, double d, double a, double alpha);
+        // fM0 and nMe, 16 values column major, identity by default
+        void setBaseTransform(const std::vector<double> & fM0){ base = fM0; }
+        void setToolTransform(const std::vector<double> & nMe){ tool = nMe; }
+        unsigned int getJointCount() const { return joints.size(); }
+
+        void compute(const std::vector<double> & q, std::vector<double> & fMe, std::vector<double> & fJe) const;
+
+    private:
+        struct Joint
+        {
+            JointType type;
+            double theta, d, a, alpha;
+        };
+        std::vector<Joint> joints;
+        std::vector<double> base;
+        std::vector<double> tool;
+};
+
+#ifdef WITH_VISP
+// A ViSP robot model with get_fMe(q, fMe) and get_fJe(q, fJe), vpViper650
+// for instance
+template <class Robot>
+class vpVisaViSPModel : public vpVisaKinematicModel
+{
+    public:
+        void compute(const std::vector<double> & q, std::vector<double> & fMe, std::vector<double> & fJe) const
+        {
+            vpColVector joints(q);
+            vpHomogeneousMatrix M;
+            vpMatrix J;
+            robot.get_fMe(joints, M);
+            robot.get_fJe(joints, J);
+            fMe.resize(16);
+            for (int i = 0; i < 4; i++){
+                for (int j = 0; j < 4; j++){
+                    fMe[4*j+i] = M[i][j];
+                }
+            }
+            fJe.resize(6 * J.getCols());
+            for (unsigned int i = 0; i < 6; i++){
+                for (unsigned int j = 0; j < J.getCols(); j++){
+                    fJe[J.getCols()*i + j] = J[i][j];
+                }
+            }
+        }
+
+        Robot robot;
+};
+#endif
+
+#endif // VP_VISA_KINEMATICS_H
@@ -0,0 +1,64 @@
+#include "vpVisaLatency.h"
+
+#include <algorithm>
+
+unsigned int vpVisaHistogram::bucket(unsigned long long ns)
+{
+    if (ns < 4) return ns;
+    int msb = 63;
+    while (!(ns >> msb)) msb--;
+    // 4 buckets between 2^msb and 2^(msb+1), on the two bits after the msb
+    unsigned int index = 4 * (msb - 1) + ((ns >> (msb - 2)) & 3);
+    return std::min(index, BUCKETS - 1);
+}
+
+double vpVisaHistogram::middle(unsigned int bucket)
+{
+    if (bucket < 4) return bucket;
+    int msb = bucket / 4 + 1;
+    double low = (double)((4ULL + bucket % 4) << (msb - 2));
+    return low + (double)(1ULL << (msb - 2)) / 2;
+}
+
+void vpVisaHistogram::record(unsigned long long ns)
+{
+    counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+    unsigned long long previous = max.load(std::memory_order_relaxed);
+    while (ns > previous && !max.compare_exchange_weak(previous, ns, std::memory_order_relaxed)) {}
+}
+
+void vpVisaHistogram::reset()
+{
+    for (unsigned int i = 0; i < BUCKETS; i++) counts[i].store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+const vpVisaLatency vpVisaHistogram::summarize() const
+{
+    // the buckets are read one by one, their total may differ from count
+    unsigned long long snapshot[BUCKETS];
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < BUCKETS; i++){
+        snapshot[i] = counts[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+    }
+
+    vpVisaLatency latency;
+    latency.count = total;
+    latency.mean = total ? sum.load(std::memory_order_relaxed) / 1000.0 / total : 0;
+    latency.max = max.load(std::memory_order_relaxed) / 1000.0;
+
+    double * percentiles[] = { &latency.p50, &latency.p90, &latency.p99 };
+    const double ranks[] = { 0.50, 0.90, 0.99 };
+    for (int k = 0; k < 3; k++){
+        unsigned long long rank = (unsigned long long)(ranks[k] * total), seen = 0;
+        unsigned int i = 0;
+        while (i + 1 < BUCKETS && seen + snapshot[i] <= rank) seen += snapshot[i++];
+        *percentiles[k] = total ? std::min(middle(i) / 1000.0, latency.max) : 0;
+    }
+    return latency;
+}
@@ -0,0 +1,44 @@
+#ifndef VP_VISA_LATENCY_H
+#define VP_VISA_LATENCY_H
+
+#include <atomic>
+
+// Summary of a vpVisaHistogram, in microseconds
+struct vpVisaLatency
+{
+    unsigned long long count;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+// Lock-free latency histogram: 4 buckets per power of two of nanoseconds
+// (percentiles within 12%), from 1 ns to about 17 s. Recording is a few
+// relaxed atomic operations, from any number of threads.
+class vpVisaHistogram
+{
+    public:
+        static const unsigned int BUCKETS = 136;
+
+        vpVisaHistogram(){ this->reset(); }
+
+        void record(unsigned long long ns);
+        // not synchronized with record(): a concurrent sample may be lost
+        void reset();
+
+        unsigned long long getCount() const { return count.load(std::memory_order_relaxed); }
+        const vpVisaLatency summarize() const;
+
+    private:
+        static unsigned int bucket(unsigned long long ns);
+        static double middle(unsigned int bucket); // ns
+
+        std::atomic<unsigned long long> counts[BUCKETS];
+        std::atomic<unsigned long long> count;
+        std::atomic<unsigned long long> sum;
+        std::atomic<unsigned long long> max;
+};
+
+#endif // VP_VISA_LATENCY_H
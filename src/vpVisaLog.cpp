@@ -0,0 +1,146 @@
+#include "vpVisaLog.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+static int initialLevel()
+{
+    const char * level = getenv("VISA_LOG_LEVEL");
+    return level ? atoi(level) : VISA_LOG_WARNING;
+}
+
+std::atomic<int> vpVisaLog::runtimeLevel(initialLevel());
+
+namespace
+{
+    // Bounded multi-producer queue (Vyukov): a slot is free for position p
+    // when its sequence is p, and holds the message of position p when its
+    // sequence is p + 1. A single thread prints and frees the slots.
+    class Logger
+    {
+        public:
+            Logger() : head(0), tail(0), dropped(0), reported(0), running(true)
+            {
+                for (unsigned int i = 0; i < vpVisaLog::CAPACITY; i++) slots[i].sequence = i;
+                thread = std::thread(&Logger::drain, this);
+            }
+
+            ~Logger()
+            {
+                running = false;
+                thread.join();
+            }
+
+            void push(int level, const char * format, va_list args)
+            {
+                unsigned long long position = head.load(std::memory_order_relaxed);
+                Slot * slot;
+                while (true){
+                    slot = &slots[position % vpVisaLog::CAPACITY];
+                    long long difference = (long long)(slot->sequence.load(std::memory_order_acquire) - position);
+                    if (difference == 0){
+                        if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+                    }
+                    else if (difference < 0){
+                        dropped.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    }
+                    else{
+                        position = head.load(std::memory_order_relaxed);
+                    }
+                }
+                slot->level = level;
+                vsnprintf(slot->text, sizeof(slot->text), format, args);
+                slot->sequence.store(position + 1, std::memory_order_release);
+            }
+
+            void flush()
+            {
+                unsigned long long position = head.load(std::memory_order_acquire);
+                while (tail.load(std::memory_order_acquire) < position){
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+
+            unsigned long long getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+        private:
+            struct Slot
+            {
+                std::atomic<unsigned long long> sequence;
+                int level;
+                char text[vpVisaLog::LINE_SIZE];
+            };
+
+            // prints what is queued, false if there was nothing
+            bool print()
+            {
+                bool printed = false, out = false, err = false;
+                unsigned long long position = tail.load(std::memory_order_relaxed);
+                while (true){
+                    Slot & slot = slots[position % vpVisaLog::CAPACITY];
+                    if (slot.sequence.load(std::memory_order_acquire) != position + 1) break;
+                    bool error = slot.level <= VISA_LOG_WARNING;
+                    (error ? std::cerr : std::cout) << slot.text << '\n';
+                    (error ? err : out) = true;
+                    slot.sequence.store(position + vpVisaLog::CAPACITY, std::memory_order_release);
+                    tail.store(++position, std::memory_order_release);
+                    printed = true;
+                }
+
+                unsigned long long lost = dropped.load(std::memory_order_relaxed);
+                if (lost != reported){
+                    std::cerr << "WARNING: " << lost - reported << " log messages dropped\n";
+                    reported = lost;
+                    err = true;
+                }
+                if (out) std::cout.flush();
+                if (err) std::cerr.flush();
+                return printed;
+            }
+
+            void drain()
+            {
+                while (running){
+                    if (!this->print()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                this->print();
+            }
+
+            Slot slots[vpVisaLog::CAPACITY];
+            std::atomic<unsigned long long> head; // next position to fill
+            std::atomic<unsigned long long> tail; // next position to print
+            std::atomic<unsigned long long> dropped;
+            unsigned long long reported; // drops already reported, printing thread only
+            std::atomic<bool> running;
+            std::thread thread;
+    };
+
+    Logger & logger()
+    {
+        static Logger instance; // started on the first message
+        return instance;
+    }
+}
+
+void vpVisaLog::write(int level, const char * format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    logger().push(level, format, args);
+    va_end(args);
+}
+
+void vpVisaLog::flush()
+{
+    logger().flush();
+}
+
+unsigned long long vpVisaLog::getDroppedCount()
+{
+    return logger().getDropped();
+}
@@ -0,0 +1,62 @@
+#ifndef VP_VISA_LOG_H
+#define VP_VISA_LOG_H
+
+#include <atomic>
+
+// Messages of the adapter, by decreasing severity
+enum vpVisaLogLevel
+{
+    VISA_LOG_NONE = 0,
+    VISA_LOG_ERROR,
+    VISA_LOG_WARNING, // fallbacks to a slower path
+    VISA_LOG_INFO,
+    VISA_LOG_DEBUG,   // every command
+    VISA_LOG_TRACE    // every frame
+};
+
+// Levels above VISA_LOG_MAX_LEVEL are compiled out
+#ifndef VISA_LOG_MAX_LEVEL
+#define VISA_LOG_MAX_LEVEL VISA_LOG_TRACE
+#endif
+
+// printf-like, formatted only when the level is enabled at runtime
+#define VISA_LOG(level, ...) \
+    do{ \
+        if ((level) <= VISA_LOG_MAX_LEVEL && vpVisaLog::isEnabled(level)) vpVisaLog::write(level, __VA_ARGS__); \
+    } while (0)
+
+#ifdef __GNUC__
+#define VISA_LOG_PRINTF(formatIndex, argsIndex) __attribute__((format(printf, formatIndex, argsIndex)))
+#else
+#define VISA_LOG_PRINTF(formatIndex, argsIndex)
+#endif
+
+// Asynchronous console log shared by all the adapters.
+//
+// A message is formatted by the caller into a slot of a lock-free ring
+// buffer and printed by a background thread, errors and warnings on stderr,
+// the others on stdout. The caller never waits for the console: when the
+// buffer is full the message is dropped and counted. The runtime level is
+// VISA_LOG_WARNING unless setLevel() or the VISA_LOG_LEVEL environment
+// variable (0 to 5) says otherwise.
+class vpVisaLog
+{
+    public:
+        static const unsigned int CAPACITY = 1024; // messages
+        static const unsigned int LINE_SIZE = 256;  // longer messages are truncated
+
+        static void setLevel(int level){ runtimeLevel.store(level, std::memory_order_relaxed); }
+        static int getLevel(){ return runtimeLevel.load(std::memory_order_relaxed); }
+        static const bool isEnabled(int level){ return level <= runtimeLevel.load(std::memory_order_relaxed); }
+
+        // queues the message whatever the level
+        static void write(int level, const char * format, ...) VISA_LOG_PRINTF(2, 3);
+        // returns once everything queued so far is printed
+        static void flush();
+        static unsigned long long getDroppedCount();
+
+    private:
+        static std::atomic<int> runtimeLevel;
+};
+
+#endif // VP_VISA_LOG_H
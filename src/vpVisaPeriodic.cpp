@@ -0,0 +1,184 @@
+#include "vpVisaPeriodic.h"
+#include "vpVisaLog.h"
+
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+static long long now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// until the steady_clock time, in ns
+static void sleepUntil(long long time)
+{
+    #ifdef __linux__
+        // steady_clock is CLOCK_MONOTONIC
+        struct timespec ts;
+        ts.tv_sec = time / 1000000000LL;
+        ts.tv_nsec = time % 1000000000LL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    #else
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(time)));
+    #endif
+}
+
+vpVisaPeriodic::vpVisaPeriodic(unsigned int periodUs, vpVisaOverrunPolicy policy)
+    : period(periodUs * 1000LL), policy(policy), priority(0), cpu(-1), running(false), stopping(false),
+      deadline(0), cycleStart(0), savedPolicy(0), savedPriority(0), savedAffinity(false)
+{
+    this->resetStats();
+}
+
+vpVisaPeriodic::~vpVisaPeriodic()
+{
+    this->stop();
+}
+
+void vpVisaPeriodic::setRealtime(int priority, int cpu)
+{
+    this->priority = priority;
+    this->cpu = cpu;
+}
+
+void vpVisaPeriodic::begin()
+{
+    realtime = pinned = false;
+    savedAffinity = false;
+    #ifdef __linux__
+        pthread_t self = pthread_self();
+        if (priority > 0){
+            struct sched_param param;
+            pthread_getschedparam(self, &savedPolicy, &param);
+            savedPriority = param.sched_priority;
+            param.sched_priority = priority;
+            int error = pthread_setschedparam(self, SCHED_FIFO, &param);
+            if (error == 0) realtime = true;
+            else VISA_LOG(VISA_LOG_WARNING, "SCHED_FIFO not permitted (%s), periodic loop in normal scheduling", strerror(error));
+        }
+        if (cpu >= 0){
+            savedAffinity = pthread_getaffinity_np(self, sizeof(savedCpus), &savedCpus) == 0;
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+            int error = pthread_setaffinity_np(self, sizeof(cpus), &cpus);
+            if (error == 0) pinned = true;
+            else VISA_LOG(VISA_LOG_WARNING, "cannot bind the periodic loop to CPU %d (%s)", cpu, strerror(error));
+        }
+    #else
+        if (priority > 0 || cpu >= 0) VISA_LOG(VISA_LOG_WARNING, "real-time scheduling is only supported on Linux");
+    #endif
+
+    running = true;
+    cycleStart = now();
+    deadline = cycleStart + period;
+}
+
+const bool vpVisaPeriodic::wait()
+{
+    long long end = now();
+    duration.record(end - cycleStart);
+
+    if (end > deadline){
+        overruns.fetch_add(1, std::memory_order_relaxed);
+        if (policy == VISA_OVERRUN_SKIP){
+            // first deadline of the grid still ahead
+            long long missed = (end - deadline) / period + 1;
+            skipped.fetch_add(missed, std::memory_order_relaxed);
+            deadline += missed * period;
+        }
+    }
+    if (stopping) return false;
+
+    if (deadline > end) sleepUntil(deadline);
+    cycleStart = now();
+    lateness.record(cycleStart > deadline ? cycleStart - deadline : 0);
+    deadline += period;
+    return !stopping;
+}
+
+void vpVisaPeriodic::end()
+{
+    #ifdef __linux__
+        pthread_t self = pthread_self();
+        if (realtime){
+            struct sched_param param;
+            param.sched_priority = savedPriority;
+            pthread_setschedparam(self, savedPolicy, &param);
+        }
+        if (savedAffinity) pthread_setaffinity_np(self, sizeof(savedCpus), &savedCpus);
+    #endif
+    realtime = pinned = false;
+    stopping = false;
+    running = false;
+}
+
+void vpVisaPeriodic::run(const std::function<bool()> & cycle)
+{
+    this->begin();
+    while (cycle() && this->wait());
+    this->end();
+}
+
+const bool vpVisaPeriodic::start(const std::function<bool()> & cycle)
+{
+    if (running || thread.joinable()) return false;
+    // running before the thread starts, so that stop() always joins it
+    running = true;
+    thread = std::thread([this, cycle](){ this->run(cycle); });
+    return true;
+}
+
+void vpVisaPeriodic::stop()
+{
+    if (running) stopping = true;
+    if (thread.joinable() && thread.get_id() != std::this_thread::get_id()) thread.join();
+}
+
+const vpVisaPeriodicStats vpVisaPeriodic::getStats() const
+{
+    vpVisaPeriodicStats stats;
+    stats.cycles = duration.getCount();
+    stats.overruns = overruns.load(std::memory_order_relaxed);
+    stats.skipped = skipped.load(std::memory_order_relaxed);
+    stats.lateness = lateness.summarize();
+    stats.duration = duration.summarize();
+    stats.realtime = realtime;
+    stats.pinned = pinned;
+    return stats;
+}
+
+void vpVisaPeriodic::resetStats()
+{
+    lateness.reset();
+    duration.reset();
+    overruns = 0;
+    skipped = 0;
+}
+
+void vpVisaPeriodic::printStats(std::ostream & out) const
+{
+    vpVisaPeriodicStats stats = this->getStats();
+    std::ostringstream text; // one write, not mixed with other threads
+    text << std::fixed << std::setprecision(1)
+         << "VISA loop (us), period " << period / 1000 << ", " << stats.cycles << " cycles, "
+         << stats.overruns << " overruns, " << stats.skipped << " skipped"
+         << (stats.realtime ? ", SCHED_FIFO" : "") << (stats.pinned ? ", pinned" : "") << std::endl
+         << "                           mean       p50       p90       p99       max" << std::endl;
+    const vpVisaLatency * rows[] = { &stats.lateness, &stats.duration };
+    const char * names[] = { "lateness", "duration" };
+    for (int i = 0; i < 2; i++){
+        text << "  " << std::left << std::setw(16) << names[i] << std::right << std::setw(9) << ""
+             << std::setw(10) << rows[i]->mean << std::setw(10) << rows[i]->p50 << std::setw(10) << rows[i]->p90
+             << std::setw(10) << rows[i]->p99 << std::setw(10) << rows[i]->max << std::endl;
+    }
+    out << text.str() << std::flush;
+}
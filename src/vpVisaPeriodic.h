@@ -0,0 +1,111 @@
+#ifndef VP_VISA_PERIODIC_H
+#define VP_VISA_PERIODIC_H
+
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "vpVisaLatency.h"
+
+// What to do with the deadlines a cycle has run past
+enum vpVisaOverrunPolicy
+{
+    VISA_OVERRUN_SKIP,    // drop them, the next cycle starts on the period grid
+    VISA_OVERRUN_CATCH_UP // run a cycle for each of them without sleeping
+};
+
+struct vpVisaPeriodicStats
+{
+    unsigned long long cycles;
+    unsigned long long overruns; // cycles that ended after the next deadline
+    unsigned long long skipped;  // deadlines dropped by VISA_OVERRUN_SKIP
+    vpVisaLatency lateness;      // start of a cycle after its deadline
+    vpVisaLatency duration;      // run time of a cycle
+    bool realtime;               // SCHED_FIFO in effect
+    bool pinned;                 // bound to the requested CPU
+};
+
+// Periodic loop on absolute deadlines, which does not drift with the run time
+// of the cycles as vpTime::wait(t, period) does.
+//
+// Either drives the cycle itself:
+//     vpVisaPeriodic loop(1000);
+//     loop.run([&](){ ...; return !done; });
+// or paces a loop written by hand:
+//     loop.begin();
+//     while (!done){ ...; loop.wait(); }
+//     loop.end();
+// Sleeps with clock_nanosleep on CLOCK_MONOTONIC on Linux, where the loop
+// thread can also be given SCHED_FIFO and a CPU. Statistics can be read from
+// any thread while the loop runs.
+class vpVisaPeriodic
+{
+    public:
+        vpVisaPeriodic(unsigned int periodUs = 40000, vpVisaOverrunPolicy policy = VISA_OVERRUN_SKIP);
+        ~vpVisaPeriodic();
+
+        // before the loop starts
+        void setPeriod(unsigned int us){ period = us * 1000LL; }
+        unsigned int getPeriod() const { return period / 1000; }
+        void setOverrunPolicy(vpVisaOverrunPolicy policy){ this->policy = policy; }
+        // SCHED_FIFO at priority 1 to 99 (0: scheduling unchanged) and bound to
+        // cpu (-1: any) while the loop runs. Where it is not permitted the
+        // loop runs anyway, see getStats().
+        void setRealtime(int priority, int cpu = -1);
+
+        // first deadline one period from now, scheduling of the calling thread
+        // changed as requested
+        void begin();
+        // end of a cycle: accounts for it and sleeps until the next deadline.
+        // False once stop() is called.
+        const bool wait();
+        // scheduling of the calling thread restored
+        void end();
+
+        // cycle() once per period, on the calling thread, until it returns
+        // false or stop() is called
+        void run(const std::function<bool()> & cycle);
+        // the same on a thread of its own
+        const bool start(const std::function<bool()> & cycle);
+        // from any thread, returns once a thread started by start() is done
+        void stop();
+        const bool isRunning() const { return running; }
+
+        const vpVisaPeriodicStats getStats() const;
+        void resetStats();
+        void printStats(std::ostream &) const;
+
+    private:
+        long long period; // ns
+        vpVisaOverrunPolicy policy;
+        int priority;
+        int cpu;
+
+        std::atomic<bool> running;
+        std::atomic<bool> stopping;
+        std::thread thread;
+        long long deadline;   // steady_clock ns of the next cycle
+        long long cycleStart;
+
+        // scheduling of the loop thread before begin()
+        int savedPolicy;
+        int savedPriority;
+        bool savedAffinity;
+        #ifdef __linux__
+            cpu_set_t savedCpus;
+        #endif
+
+        vpVisaHistogram lateness;
+        vpVisaHistogram duration;
+        std::atomic<unsigned long long> overruns;
+        std::atomic<unsigned long long> skipped;
+        std::atomic<bool> realtime;
+        std::atomic<bool> pinned;
+};
+
+#endif // VP_VISA_PERIODIC_H
@@ -0,0 +1,259 @@
+#include "vpVisaProtocol.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+static const struct
+{
+    unsigned char opcode;
+    const char * name;
+} commands[] = {
+    { vpVisaProtocol::OP_GETJOINTPOS,    "GETJOINTPOS" },
+    { vpVisaProtocol::OP_GETTOOLPOS,     "GETTOOLPOS" },
+    { vpVisaProtocol::OP_GETCALIBMAT,    "GETCALIBMAT" },
+    { vpVisaProtocol::OP_GETJACOBIAN,    "GETJACOBIAN" },
+    { vpVisaProtocol::OP_SETJOINTVEL,    "SETJOINTVEL" },
+    { vpVisaProtocol::OP_SETJOINTPOSABS, "SETJOINTPOSABS" },
+    { vpVisaProtocol::OP_SETJOINTPOSREL, "SETJOINTPOSREL" },
+    { vpVisaProtocol::OP_HOMING,         "HOMING" },
+    { vpVisaProtocol::OP_TICK,           "TICK" },
+};
+
+const char * vpVisaProtocol::name(unsigned char opcode)
+{
+    for (unsigned int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++){
+        if (commands[i].opcode == opcode) return commands[i].name;
+    }
+    return "";
+}
+
+unsigned char vpVisaProtocol::opcode(const char * name, unsigned int length)
+{
+    for (unsigned int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++){
+        if (strlen(commands[i].name) == length && strncmp(commands[i].name, name, length) == 0)
+            return commands[i].opcode;
+    }
+    return OP_NONE;
+}
+
+unsigned int vpVisaProtocol::encode(unsigned char * buffer, unsigned int capacity, unsigned char opcode,
+                                    const double * values, unsigned int count, unsigned short sequence)
+{
+    unsigned int size = HEADER_SIZE + 8 * count;
+    if (count > MAX_VALUES || size > capacity) return 0;
+
+    buffer[0] = 'V';
+    buffer[1] = 'B';
+    buffer[2] = VISA_PROTOCOL_VERSION;
+    buffer[3] = opcode;
+    buffer[4] = (unsigned char)count;
+    buffer[5] = (unsigned char)(count >> 8);
+    buffer[6] = (unsigned char)sequence;
+    buffer[7] = (unsigned char)(sequence >> 8);
+    for (unsigned int i = 0; i < count; i++){
+        writeDouble(buffer + HEADER_SIZE + 8 * i, values[i]);
+    }
+    return size;
+}
+
+const bool vpVisaProtocol::decode(const unsigned char * buffer, unsigned int size,
+                                  Header & header, const unsigned char * & values)
+{
+    if (!isBinary(buffer, size) || buffer[2] != VISA_PROTOCOL_VERSION) return false;
+
+    header.opcode = buffer[3];
+    header.count = buffer[4] | (buffer[5] << 8);
+    header.sequence = buffer[6] | (buffer[7] << 8);
+    if (header.count > MAX_VALUES || size < HEADER_SIZE + 8u * header.count) return false;
+
+    values = buffer + HEADER_SIZE;
+    return true;
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// strtod on a bounded copy of the token, for what the fast path cannot do exactly
+static bool parseSlow(const char * token, const char * end, double & value)
+{
+    char copy[64];
+    unsigned int length = end - token;
+    if (length == 0 || length >= sizeof(copy)) return false;
+    memcpy(copy, token, length);
+    copy[length] = '\0';
+
+    char * stop;
+    value = strtod(copy, &stop);
+    while (*stop == ' ' || *stop == '\t') stop++;
+    return stop != copy && *stop == '\0';
+}
+
+int vpVisaProtocol::parseText(const char * text, unsigned int size, double * values, unsigned int capacity)
+{
+    // exact powers of ten of a double
+    static const double powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char * p = text;
+    const char * end = text + size;
+    while (end > p && (end[-1] == '\0' || end[-1] == '_' || end[-1] == ' ' ||
+                       (end[-1] >= '\t' && end[-1] <= '\r'))) end--;
+    if (p == end) return 0;
+
+    unsigned int count = 0;
+    while (true){
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        const char * token = p;
+
+        bool negative = (p < end && *p == '-');
+        if (p < end && (*p == '-' || *p == '+')) p++;
+        unsigned long long mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        for (; p < end && isDigit(*p); p++, digits++) mantissa = mantissa * 10 + (*p - '0');
+        if (p < end && *p == '.'){
+            for (p++; p < end && isDigit(*p); p++, digits++, exponent--) mantissa = mantissa * 10 + (*p - '0');
+        }
+        if (digits > 0 && p < end && (*p == 'e' || *p == 'E')){
+            const char * e = p + 1;
+            bool negativeExponent = (e < end && *e == '-');
+            if (e < end && (*e == '-' || *e == '+')) e++;
+            int value = 0;
+            if (e < end && isDigit(*e)){
+                for (; e < end && isDigit(*e); e++) value = std::min(value * 10 + (*e - '0'), 100000);
+                exponent += negativeExponent ? -value : value;
+                p = e;
+            }
+        }
+
+        const char * next = p;
+        while (next < end && (*next == ' ' || *next == '\t')) next++;
+        bool complete = (next == end || *next == ',');
+
+        double value;
+        if (complete && digits > 0 && digits <= 19 && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22){
+            // both operands exact: the result is correctly rounded
+            value = exponent < 0 ? mantissa / powers[-exponent] : mantissa * powers[exponent];
+            if (negative) value = -value;
+        }
+        else{
+            // more digits, large exponents, nan, inf, hexadecimal
+            while (p < end && *p != ',') p++;
+            if (!parseSlow(token, p, value)) return -1;
+        }
+
+        if (count == capacity) return -1;
+        values[count++] = value;
+
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p == end) return count;
+        if (*p++ != ',') return -1;
+    }
+}
+
+// tile (column, row) of a width x height image: origin and size, clipped at the edges
+static void tileBounds(unsigned int column, unsigned int row, unsigned int width, unsigned int height,
+                       unsigned int & x0, unsigned int & y0, unsigned int & w, unsigned int & h)
+{
+    x0 = column * vpVisaProtocol::DELTA_TILE;
+    y0 = row * vpVisaProtocol::DELTA_TILE;
+    w = std::min(vpVisaProtocol::DELTA_TILE, width - x0);
+    h = std::min(vpVisaProtocol::DELTA_TILE, height - y0);
+}
+
+unsigned int vpVisaProtocol::encodeDelta(unsigned char * buffer, unsigned int capacity,
+                                         const unsigned char * image, const unsigned char * reference,
+                                         unsigned int width, unsigned int height,
+                                         unsigned int frame, unsigned int referenceFrame)
+{
+    const unsigned int keySize = DELTA_HEADER_SIZE + width * height;
+    if (capacity < DELTA_HEADER_SIZE) return 0;
+    writeUint32(buffer, frame);
+    writeUint32(buffer + 8, width);
+    writeUint32(buffer + 12, height);
+
+    if (reference != NULL){
+        const unsigned int limit = std::min(capacity, keySize);
+        const unsigned int columns = (width + DELTA_TILE - 1) / DELTA_TILE;
+        const unsigned int rows = (height + DELTA_TILE - 1) / DELTA_TILE;
+        unsigned int size = DELTA_HEADER_SIZE;
+        bool fits = true;
+        for (unsigned int row = 0; fits && row < rows; row++){
+            for (unsigned int column = 0; column < columns; column++){
+                unsigned int x0, y0, w, h;
+                tileBounds(column, row, width, height, x0, y0, w, h);
+                bool changed = false;
+                for (unsigned int y = y0; y < y0 + h && !changed; y++){
+                    changed = memcmp(image + (size_t)y * width + x0, reference + (size_t)y * width + x0, w) != 0;
+                }
+                if (!changed) continue;
+                if (size + 4 + w * h >= limit){
+                    fits = false;
+                    break;
+                }
+
+                buffer[size++] = (unsigned char)column;
+                buffer[size++] = (unsigned char)(column >> 8);
+                buffer[size++] = (unsigned char)row;
+                buffer[size++] = (unsigned char)(row >> 8);
+                for (unsigned int y = y0; y < y0 + h; y++, size += w){
+                    memcpy(buffer + size, image + (size_t)y * width + x0, w);
+                }
+            }
+        }
+        if (fits){
+            writeUint32(buffer + 4, referenceFrame);
+            return size;
+        }
+    }
+
+    // key frame
+    if (capacity < keySize) return 0;
+    writeUint32(buffer + 4, 0);
+    memcpy(buffer + DELTA_HEADER_SIZE, image, width * height);
+    return keySize;
+}
+
+const bool vpVisaProtocol::applyDelta(const unsigned char * buffer, unsigned int size,
+                                      unsigned char * image, unsigned int width, unsigned int height,
+                                      unsigned int & frame)
+{
+    if (size < DELTA_HEADER_SIZE || readUint32(buffer + 8) != width || readUint32(buffer + 12) != height){
+        return false;
+    }
+    const unsigned int reference = readUint32(buffer + 4);
+    const unsigned char * tiles = buffer + DELTA_HEADER_SIZE;
+    const unsigned char * end = buffer + size;
+
+    if (reference == 0){
+        if ((unsigned int)(end - tiles) != width * height) return false;
+        memcpy(image, tiles, width * height);
+        frame = readUint32(buffer);
+        return true;
+    }
+    if (reference != frame) return false;
+
+    // checked whole before the image is touched
+    for (int pass = 0; pass < 2; pass++){
+        for (const unsigned char * p = tiles; p < end; ){
+            if (end - p < 4) return false;
+            unsigned int column = p[0] | (p[1] << 8);
+            unsigned int row = p[2] | (p[3] << 8);
+            p += 4;
+            if (column * DELTA_TILE >= width || row * DELTA_TILE >= height) return false;
+
+            unsigned int x0, y0, w, h;
+            tileBounds(column, row, width, height, x0, y0, w, h);
+            if ((unsigned int)(end - p) < w * h) return false;
+            for (unsigned int y = y0; y < y0 + h; y++, p += w){
+                if (pass == 1) memcpy(image + (size_t)y * width + x0, p, w);
+            }
+        }
+    }
+    frame = readUint32(buffer);
+    return true;
+}
@@ -0,0 +1,140 @@
+#ifndef VP_VISA_PROTOCOL_H
+#define VP_VISA_PROTOCOL_H
+
+#include <string.h>
+
+// Binary encoding of the numeric VISA commands.
+//
+// A binary datagram is an 8 byte header followed by count IEEE-754 doubles,
+// everything little endian:
+//
+//   offset 0  'V' 'B'         magic
+//   offset 2  version         VISA_PROTOCOL_VERSION
+//   offset 3  opcode          vpVisaProtocol::Opcode
+//   offset 4  count (uint16)  number of doubles
+//   offset 6  sequence        request id echoed in the reply (0 if unused)
+//
+// Text commands never start with the magic, so both encodings can share the
+// same socket. The binary mode is negotiated with "SETPROTOCOL,BINARY"; a
+// simulator that does not answer "OK" keeps being spoken to in text.
+//
+// TICK batches a control cycle in one round trip, in text as in binary:
+//   request  mask, then the joint velocities to apply (none: no command)
+//   reply    for each quantity of the mask (1 GETJOINTPOS, 2 GETTOOLPOS,
+//            4 GETJACOBIAN), in bit order, its number of values then the values
+//
+// GETIMAGEDELTA,<frame> returns a grey image, like GETIMAGEBW, as the tiles
+// that changed since the given frame (0: none held). Its payload starts with
+// four uint32: frame id, reference id, width, height. A key frame (reference
+// 0) continues with the whole image. A delta continues, for each changed
+// DELTA_TILE x DELTA_TILE tile, with its column and row (uint16) and its
+// pixels, clipped at the right and bottom edges.
+
+#define VISA_PROTOCOL_VERSION 1
+
+class vpVisaProtocol
+{
+    public:
+        enum Opcode
+        {
+            OP_NONE = 0,
+            // requests
+            OP_GETJOINTPOS = 1,
+            OP_GETTOOLPOS,
+            OP_GETCALIBMAT,
+            OP_GETJACOBIAN,
+            OP_SETJOINTVEL,
+            OP_SETJOINTPOSABS,
+            OP_SETJOINTPOSREL,
+            OP_HOMING,
+            OP_TICK,
+            // replies
+            OP_VALUES = 0x80,
+            OP_OK,
+            OP_ERROR
+        };
+
+        struct Header
+        {
+            unsigned char opcode;
+            unsigned short count;
+            unsigned short sequence;
+        };
+
+        static const unsigned int HEADER_SIZE = 8;
+        static const unsigned int MAX_VALUES = 128;
+        static const unsigned int MAX_DATAGRAM = HEADER_SIZE + 8 * MAX_VALUES;
+        static const unsigned int DELTA_HEADER_SIZE = 16;
+        static const unsigned int DELTA_TILE = 16;
+
+        // text command name <-> opcode
+        static const char * name(unsigned char opcode);
+        static unsigned char opcode(const char * name, unsigned int length);
+
+        // requests that can be sent again without changing their outcome
+        static const bool isRepeatable(unsigned char opcode)
+        {
+            return opcode != OP_SETJOINTPOSREL;
+        }
+
+        static const bool isBinary(const unsigned char * buffer, unsigned int size)
+        {
+            return size >= HEADER_SIZE && buffer[0] == 'V' && buffer[1] == 'B';
+        }
+
+        // returns the datagram size, 0 if it does not fit in capacity
+        static unsigned int encode(unsigned char * buffer, unsigned int capacity, unsigned char opcode,
+                                   const double * values, unsigned int count, unsigned short sequence = 0);
+
+        // checks the header and the announced size, values points to the first double
+        static const bool decode(const unsigned char * buffer, unsigned int size,
+                                 Header & header, const unsigned char * & values);
+
+        // Parses a text reply "v1,v2,...,vn" where it lies, at full double
+        // precision and without allocating. Trailing blanks and '_' padding
+        // are ignored. Returns the number of values, -1 for a token that is
+        // not a number or more than capacity values.
+        static int parseText(const char * text, unsigned int size, double * values, unsigned int capacity);
+
+        // GETIMAGEDELTA payload of image against reference (NULL: key frame),
+        // a key frame whenever it is not larger. Returns the payload size,
+        // 0 if it does not fit in capacity.
+        static unsigned int encodeDelta(unsigned char * buffer, unsigned int capacity,
+                                        const unsigned char * image, const unsigned char * reference,
+                                        unsigned int width, unsigned int height,
+                                        unsigned int frame, unsigned int referenceFrame);
+        // applies a payload to image, which holds frame (0 for none) and
+        // becomes the new frame. False, image unchanged, if the payload is
+        // malformed, of another size or against another frame.
+        static const bool applyDelta(const unsigned char * buffer, unsigned int size,
+                                     unsigned char * image, unsigned int width, unsigned int height,
+                                     unsigned int & frame);
+
+        static unsigned int readUint32(const unsigned char * p)
+        {
+            return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+        }
+
+        static void writeUint32(unsigned char * p, unsigned int value)
+        {
+            for (int i = 0; i < 4; i++, value >>= 8) p[i] = (unsigned char)value;
+        }
+
+        static double readDouble(const unsigned char * p)
+        {
+            unsigned long long bits = 0;
+            for (int i = 7; i >= 0; i--) bits = (bits << 8) | p[i];
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        static void writeDouble(unsigned char * p, double value)
+        {
+            unsigned long long bits;
+            memcpy(&bits, &value, sizeof(bits));
+            for (int i = 0; i < 8; i++, bits >>= 8) p[i] = (unsigned char)bits;
+        }
+};
+
+#endif // VP_VISA_PROTOCOL_H
@@ -0,0 +1,499 @@
+#include "vpVisaRecorder.h"
+
+#include <algorithm>
+
+#include "vpVisaLog.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char MAGIC[8] = { 'V', 'I', 'S', 'A', 'R', 'E', 'C', '\0' };
+static const unsigned int VERSION = 1;
+static const size_t INITIAL_MAPPING = 64 << 20;
+
+// file header fields
+static const size_t START_TIME = 16;
+static const size_t INDEX_OFFSET = 24;
+static const size_t RECORD_COUNT = 32;
+static const size_t RECORDS_END = 40;
+
+template <typename T> static void put(unsigned char * p, T value){ memcpy(p, &value, sizeof(T)); }
+template <typename T> static T get(const unsigned char * p){ T value; memcpy(&value, p, sizeof(T)); return value; }
+
+static size_t align8(size_t size){ return (size + 7) & ~(size_t)7; }
+
+// =============================================================================
+// RECORDER
+// =============================================================================
+
+vpVisaRecorder::vpVisaRecorder()
+    : head(0), tail(0), reserved(0), running(false), fd(-1), mapping(NULL), mappedSize(0), end(0),
+      referenceWidth(0), referenceHeight(0), greyFrame(0), records(0), bytes(0), dropped(0)
+{
+}
+
+vpVisaRecorder::~vpVisaRecorder()
+{
+    this->close();
+}
+
+const bool vpVisaRecorder::open(const std::string & path, unsigned int frameSize)
+{
+    if (running) return false;
+    #ifdef _WIN32
+        (void)path; (void)frameSize;
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: recording is not supported on this platform");
+        return false;
+    #else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, INITIAL_MAPPING) < 0){
+            VISA_LOG(VISA_LOG_ERROR, "ERROR: cannot create %s (%s)", path.c_str(), strerror(errno));
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+            return false;
+        }
+        void * p = mmap(NULL, INITIAL_MAPPING, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED){
+            VISA_LOG(VISA_LOG_ERROR, "ERROR: cannot map %s (%s)", path.c_str(), strerror(errno));
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        mapping = (unsigned char *)p;
+        mappedSize = INITIAL_MAPPING;
+
+        start = std::chrono::steady_clock::now();
+        memset(mapping, 0, HEADER_SIZE);
+        memcpy(mapping, MAGIC, sizeof(MAGIC));
+        put<unsigned int>(mapping + 8, VERSION);
+        put<long long>(mapping + START_TIME, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch()).count());
+        end = HEADER_SIZE;
+        put<unsigned long long>(mapping + RECORDS_END, end);
+
+        index.clear();
+        referenceWidth = referenceHeight = 0;
+        greyFrame = 0;
+        records = dropped = 0;
+        bytes = end;
+        frames = std::make_shared<vpVisaFramePool>(FRAMES, frameSize);
+        queue.resize(QUEUE_SIZE);
+        head = tail = reserved = 0;
+        running = true;
+        writer = std::thread(&vpVisaRecorder::writerLoop, this);
+        return true;
+    #endif
+}
+
+void vpVisaRecorder::close()
+{
+    if (!running) return;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        running = false;
+    }
+    queueCondition.notify_all();
+    writer.join();
+
+    #ifndef _WIN32
+        // the index after the records, then the file cut to its content.
+        // No mapping left after a failed remap: the records as they are.
+        unsigned char * p = this->reserve(index.size() * sizeof(unsigned long long));
+        if (p != NULL){
+            memcpy(p, index.data(), index.size() * sizeof(unsigned long long));
+            put<unsigned long long>(mapping + INDEX_OFFSET, end);
+            end += index.size() * sizeof(unsigned long long);
+        }
+        if (mapping != NULL) munmap(mapping, mappedSize);
+        if (ftruncate(fd, end) < 0){
+            VISA_LOG(VISA_LOG_ERROR, "ERROR: cannot truncate the recording (%s)", strerror(errno));
+        }
+        ::close(fd);
+    #endif
+    fd = -1;
+    mapping = NULL;
+    mappedSize = 0;
+    bytes = end;
+    reference.clear();
+    frames.reset();
+}
+
+vpVisaRecorder::Entry * vpVisaRecorder::beginEntry(vpVisaRecordType type)
+{
+    // queueMutex held by the caller until commitEntry()
+    if (!running || reserved == QUEUE_SIZE){
+        dropped++;
+        return NULL;
+    }
+    Entry * entry = &queue[tail];
+    entry->type = type;
+    entry->time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return entry;
+}
+
+void vpVisaRecorder::commitEntry()
+{
+    tail = (tail + 1) % QUEUE_SIZE;
+    reserved++;
+}
+
+const bool vpVisaRecorder::recordValues(vpVisaRecordType type, const char * name, const double * values, unsigned int count)
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    Entry * entry = this->beginEntry(type);
+    if (entry == NULL) return false;
+    strncpy(entry->name, name, NAME_SIZE - 1);
+    entry->name[NAME_SIZE - 1] = '\0';
+    entry->count = std::min(count, vpVisaProtocol::MAX_VALUES);
+    memcpy(entry->values, values, entry->count * sizeof(double));
+    this->commitEntry();
+    lock.unlock();
+    queueCondition.notify_one();
+    return true;
+}
+
+const bool vpVisaRecorder::recordImage(const unsigned char * data, unsigned int size)
+{
+    if (!running) return false;
+    vpVisaFrame frame = frames->acquire();
+    if (frame.empty() || size > frame.capacity()){
+        dropped++;
+        return false;
+    }
+    memcpy(frame.data(), data, size);
+    frame.setSize(size);
+
+    std::unique_lock<std::mutex> lock(queueMutex);
+    Entry * entry = this->beginEntry(VISA_RECORD_IMAGE);
+    if (entry == NULL) return false;
+    entry->frame = frame;
+    this->commitEntry();
+    lock.unlock();
+    queueCondition.notify_one();
+    return true;
+}
+
+const bool vpVisaRecorder::recordGrey(const unsigned char * image, unsigned int width, unsigned int height)
+{
+    if (!running) return false;
+    vpVisaFrame frame = frames->acquire();
+    if (frame.empty() || width * height > frame.capacity()){
+        dropped++;
+        return false;
+    }
+    // compressed by the writer thread
+    memcpy(frame.data(), image, width * height);
+    frame.setImageSize(width, height);
+
+    std::unique_lock<std::mutex> lock(queueMutex);
+    Entry * entry = this->beginEntry(VISA_RECORD_GREY);
+    if (entry == NULL) return false;
+    entry->frame = frame;
+    this->commitEntry();
+    lock.unlock();
+    queueCondition.notify_one();
+    return true;
+}
+
+const bool vpVisaRecorder::recordFrame(const vpVisaFrame & frame)
+{
+    if (frame.empty()) return false;
+    std::unique_lock<std::mutex> lock(queueMutex);
+    Entry * entry = this->beginEntry(frame.getWidth() > 0 ? VISA_RECORD_GREY : VISA_RECORD_IMAGE);
+    if (entry == NULL) return false;
+    entry->frame = frame;
+    this->commitEntry();
+    lock.unlock();
+    queueCondition.notify_one();
+    return true;
+}
+
+const vpVisaRecorderStats vpVisaRecorder::getStats() const
+{
+    vpVisaRecorderStats stats;
+    stats.records = records;
+    stats.bytes = bytes;
+    stats.dropped = dropped;
+    return stats;
+}
+
+void vpVisaRecorder::writerLoop()
+{
+    while (true){
+        std::unique_lock<std::mutex> lock(queueMutex);
+        if (reserved == 0 && running && mapping != NULL && mappedSize - end < mappedSize / 4){
+            // idle: the mapping grows now rather than while a record waits
+            lock.unlock();
+            this->remap(2 * mappedSize);
+            lock.lock();
+        }
+        queueCondition.wait(lock, [this]{ return reserved > 0 || !running; });
+        if (reserved == 0) return; // stopped, everything written
+        Entry & entry = queue[head];
+        lock.unlock();
+
+        // the producers do not touch the entry until head moves past it
+        this->write(entry);
+        entry.frame.release();
+
+        lock.lock();
+        head = (head + 1) % QUEUE_SIZE;
+        reserved--;
+    }
+}
+
+unsigned char * vpVisaRecorder::reserve(size_t size)
+{
+    #ifdef _WIN32
+        (void)size;
+        return NULL;
+    #else
+        if (mapping == NULL) return NULL;
+        if (end + size > mappedSize && !this->remap(std::max(2 * mappedSize, end + size))) return NULL;
+        return mapping + end;
+    #endif
+}
+
+const bool vpVisaRecorder::remap(size_t size)
+{
+    #ifdef _WIN32
+        (void)size;
+        return false;
+    #else
+        munmap(mapping, mappedSize);
+        void * p = MAP_FAILED;
+        if (ftruncate(fd, size) == 0){
+            p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (p == MAP_FAILED){
+            // keep what was written so far
+            VISA_LOG(VISA_LOG_ERROR, "ERROR: cannot grow the recording to %zu bytes (%s)", size, strerror(errno));
+            p = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            mapping = (p == MAP_FAILED) ? NULL : (unsigned char *)p;
+            return false;
+        }
+        mapping = (unsigned char *)p;
+        mappedSize = size;
+        return true;
+    #endif
+}
+
+void vpVisaRecorder::write(Entry & entry)
+{
+    if (mapping == NULL){
+        dropped++;
+        return;
+    }
+
+    if (entry.type == VISA_RECORD_GREY){
+        const unsigned int width = entry.frame.getWidth(), height = entry.frame.getHeight();
+        const unsigned int keySize = vpVisaProtocol::DELTA_HEADER_SIZE + width * height;
+        unsigned char * record = this->reserve(RECORD_HEADER_SIZE + keySize + 8);
+        if (record == NULL){
+            dropped++;
+            return;
+        }
+        bool key = width != referenceWidth || height != referenceHeight || greyFrame % KEY_INTERVAL == 0;
+        unsigned int size = vpVisaProtocol::encodeDelta(record + RECORD_HEADER_SIZE, keySize, entry.frame.data(),
+                                                        key ? NULL : reference.data(), width, height,
+                                                        greyFrame + 1, greyFrame);
+        // a copy: the frame may belong to the caller's pool, which gets it back
+        reference.assign(entry.frame.data(), entry.frame.data() + width * height);
+        referenceWidth = width;
+        referenceHeight = height;
+        greyFrame++;
+        this->endRecord(entry.type, record, size, entry.time);
+        return;
+    }
+
+    unsigned int size = (entry.type == VISA_RECORD_IMAGE) ? entry.frame.size() : NAME_SIZE + 8 * entry.count;
+    unsigned char * record = this->reserve(RECORD_HEADER_SIZE + align8(size));
+    if (record == NULL){
+        dropped++;
+        return;
+    }
+    unsigned char * payload = record + RECORD_HEADER_SIZE;
+    if (entry.type == VISA_RECORD_IMAGE){
+        memcpy(payload, entry.frame.data(), size);
+    }
+    else{
+        memcpy(payload, entry.name, NAME_SIZE);
+        memcpy(payload + NAME_SIZE, entry.values, 8 * entry.count);
+    }
+    this->endRecord(entry.type, record, size, entry.time);
+}
+
+void vpVisaRecorder::endRecord(vpVisaRecordType type, unsigned char * record, unsigned int payloadSize, long long time)
+{
+    put<unsigned int>(record, type);
+    put<unsigned int>(record + 4, payloadSize);
+    put<long long>(record + 8, time);
+    memset(record + RECORD_HEADER_SIZE + payloadSize, 0, align8(payloadSize) - payloadSize);
+    index.push_back(end);
+    index.push_back(time);
+    end += RECORD_HEADER_SIZE + align8(payloadSize);
+
+    // the header last: a reader never sees a partial record
+    put<unsigned long long>(mapping + RECORD_COUNT, index.size() / 2);
+    put<unsigned long long>(mapping + RECORDS_END, end);
+    records++;
+    bytes = end;
+}
+
+// =============================================================================
+// READER
+// =============================================================================
+
+vpVisaRecordReader::vpVisaRecordReader()
+    : fd(-1), mapping(NULL), mappedSize(0), startTime(0), greyWidth(0), greyHeight(0), greyFrame(0), greyRecord(-1)
+{
+}
+
+vpVisaRecordReader::~vpVisaRecordReader()
+{
+    this->close();
+}
+
+const bool vpVisaRecordReader::open(const std::string & path)
+{
+    this->close();
+    #ifdef _WIN32
+        (void)path;
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: recordings cannot be read on this platform");
+        return false;
+    #else
+        struct stat info;
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0 || fstat(fd, &info) < 0 || (size_t)info.st_size < vpVisaRecorder::HEADER_SIZE){
+            VISA_LOG(VISA_LOG_ERROR, "ERROR: cannot read %s", path.c_str());
+            this->close();
+            return false;
+        }
+        void * p = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED || memcmp(p, MAGIC, sizeof(MAGIC)) != 0 || get<unsigned int>((unsigned char *)p + 8) != VERSION){
+            VISA_LOG(VISA_LOG_ERROR, "ERROR: %s is not a recording", path.c_str());
+            if (p != MAP_FAILED) munmap(p, info.st_size);
+            this->close();
+            return false;
+        }
+        mapping = (const unsigned char *)p;
+        mappedSize = info.st_size;
+        startTime = get<long long>(mapping + START_TIME);
+
+        const unsigned long long count = get<unsigned long long>(mapping + RECORD_COUNT);
+        const unsigned long long indexOffset = get<unsigned long long>(mapping + INDEX_OFFSET);
+        const unsigned long long recordsEnd = std::min<unsigned long long>(get<unsigned long long>(mapping + RECORDS_END), mappedSize);
+        if (indexOffset != 0 && indexOffset + 16 * count <= mappedSize){
+            for (unsigned long long i = 0; i < count; i++){
+                offsets.push_back(get<unsigned long long>(mapping + indexOffset + 16 * i));
+                times.push_back(get<long long>(mapping + indexOffset + 16 * i + 8));
+            }
+        }
+        else{
+            // not closed: walk the records
+            size_t offset = vpVisaRecorder::HEADER_SIZE;
+            while (offset + vpVisaRecorder::RECORD_HEADER_SIZE <= recordsEnd){
+                size_t next = offset + vpVisaRecorder::RECORD_HEADER_SIZE + align8(get<unsigned int>(mapping + offset + 4));
+                if (next > recordsEnd) break;
+                offsets.push_back(offset);
+                times.push_back(get<long long>(mapping + offset + 8));
+                offset = next;
+            }
+        }
+        return true;
+    #endif
+}
+
+void vpVisaRecordReader::close()
+{
+    #ifndef _WIN32
+        if (mapping != NULL) munmap((void *)mapping, mappedSize);
+        if (fd >= 0) ::close(fd);
+    #endif
+    fd = -1;
+    mapping = NULL;
+    mappedSize = 0;
+    offsets.clear();
+    times.clear();
+    greyRecord = -1;
+}
+
+vpVisaRecordType vpVisaRecordReader::typeOf(unsigned int i) const
+{
+    return (vpVisaRecordType)get<unsigned int>(mapping + offsets[i]);
+}
+
+const bool vpVisaRecordReader::read(unsigned int i, vpVisaRecord & record, bool decodeGrey)
+{
+    if (i >= offsets.size()) return false;
+    const unsigned char * p = mapping + offsets[i];
+    record.type = typeOf(i);
+    record.time = times[i];
+    record.size = get<unsigned int>(p + 4);
+    record.data = p + vpVisaRecorder::RECORD_HEADER_SIZE;
+    record.name.clear();
+    record.values.clear();
+    record.width = record.height = 0;
+
+    switch (record.type){
+        case VISA_RECORD_COMMAND:
+        case VISA_RECORD_REPLY:
+            if (record.size < vpVisaRecorder::NAME_SIZE) return false;
+            record.name.assign((const char *)record.data, strnlen((const char *)record.data, vpVisaRecorder::NAME_SIZE));
+            record.values.resize((record.size - vpVisaRecorder::NAME_SIZE) / 8);
+            memcpy(record.values.data(), record.data + vpVisaRecorder::NAME_SIZE, 8 * record.values.size());
+            record.data = NULL;
+            record.size = 0;
+            return true;
+        case VISA_RECORD_GREY:
+            if (!decodeGrey) return true;
+            if (!this->readGrey(i)) return false;
+            record.data = grey.data();
+            record.size = grey.size();
+            record.width = greyWidth;
+            record.height = greyHeight;
+            return true;
+        default:
+            return true;
+    }
+}
+
+const bool vpVisaRecordReader::readGrey(unsigned int i)
+{
+    if (greyRecord == (int)i) return true;
+
+    // from the image held if it is the previous grey record, else from the key frame
+    int first = i;
+    while (vpVisaProtocol::readUint32(mapping + offsets[first] + vpVisaRecorder::RECORD_HEADER_SIZE + 4) != 0){
+        int previous = first - 1;
+        while (previous >= 0 && typeOf(previous) != VISA_RECORD_GREY) previous--;
+        if (previous < 0) return false;
+        if (previous == greyRecord) break;
+        first = previous;
+    }
+
+    for (unsigned int k = first; k <= i; k++){
+        if (typeOf(k) != VISA_RECORD_GREY) continue;
+        const unsigned char * payload = mapping + offsets[k] + vpVisaRecorder::RECORD_HEADER_SIZE;
+        unsigned int size = get<unsigned int>(mapping + offsets[k] + 4);
+        if (size < vpVisaProtocol::DELTA_HEADER_SIZE) return false;
+        unsigned int width = vpVisaProtocol::readUint32(payload + 8), height = vpVisaProtocol::readUint32(payload + 12);
+        if (width != greyWidth || height != greyHeight){
+            grey.assign((size_t)width * height, 0);
+            greyWidth = width;
+            greyHeight = height;
+            greyFrame = 0;
+        }
+        if (!vpVisaProtocol::applyDelta(payload, size, grey.data(), width, height, greyFrame)){
+            greyRecord = -1;
+            return false;
+        }
+        greyRecord = k;
+    }
+    return true;
+}
@@ -0,0 +1,171 @@
+#ifndef VP_VISA_RECORDER_H
+#define VP_VISA_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vpVisaFramePool.h"
+#include "vpVisaProtocol.h"
+
+// Session log of a vpVisaAdapter, append only, written through a memory
+// mapping. Everything in host byte order:
+//
+//   file header (64 bytes)
+//     "VISAREC" '\0', version (uint32), 0 (uint32), wall clock at the start
+//     (int64, ns since the epoch), index offset (uint64, 0 while recording),
+//     record count (uint64), end of the records (uint64)
+//   records, each one 8 byte aligned
+//     type (uint32), payload size (uint32), time (int64, ns since the start)
+//     then the payload:
+//       VISA_RECORD_IMAGE    encoded image (jpeg or png) as received
+//       VISA_RECORD_GREY     grey image as a GETIMAGEDELTA payload against
+//                            the previous grey record (see vpVisaProtocol),
+//                            a key frame every KEY_INTERVAL grey images
+//       VISA_RECORD_COMMAND  name (16 chars, '\0' padded) then the doubles sent
+//       VISA_RECORD_REPLY    name of the query then the doubles received
+//   index, once stopped: offset (uint64) and time (int64) of every record
+//
+// The header is kept up to date after every record, a log that was not
+// closed is read up to its last complete record.
+enum vpVisaRecordType
+{
+    VISA_RECORD_IMAGE = 1,
+    VISA_RECORD_GREY,
+    VISA_RECORD_COMMAND,
+    VISA_RECORD_REPLY
+};
+
+struct vpVisaRecorderStats
+{
+    unsigned long long records; // written to the log
+    unsigned long long bytes;   // size of the log
+    unsigned long long dropped; // queue full or no free frame
+};
+
+// Records are queued by the adapter's threads (values and image copied into
+// preallocated storage, or the caller's frame held) and written by a
+// background thread. The mapping grows while the writer is idle.
+class vpVisaRecorder
+{
+    public:
+        vpVisaRecorder();
+        ~vpVisaRecorder();
+
+        // frameSize: largest image recorded, in bytes
+        const bool open(const std::string & path, unsigned int frameSize);
+        // writes what is queued, the index, and closes the log
+        void close();
+        const bool isOpen() const { return running; }
+
+        // false when the record was dropped
+        const bool recordValues(vpVisaRecordType, const char * name, const double * values, unsigned int count);
+        const bool recordImage(const unsigned char * data, unsigned int size);
+        const bool recordGrey(const unsigned char * image, unsigned int width, unsigned int height);
+        // grey or encoded image, not copied: the frame is held until written
+        // and must not be modified meanwhile
+        const bool recordFrame(const vpVisaFrame & frame);
+
+        const vpVisaRecorderStats getStats() const;
+
+        static const unsigned int KEY_INTERVAL = 100;
+        static const unsigned int QUEUE_SIZE = 256;
+        static const unsigned int FRAMES = 16;
+        static const unsigned int HEADER_SIZE = 64;
+        static const unsigned int RECORD_HEADER_SIZE = 16;
+        static const unsigned int NAME_SIZE = 16;
+
+    private:
+        struct Entry
+        {
+            vpVisaRecordType type;
+            long long time;
+            char name[NAME_SIZE];
+            unsigned int count;
+            double values[vpVisaProtocol::MAX_VALUES];
+            vpVisaFrame frame;
+        };
+
+        Entry * beginEntry(vpVisaRecordType);
+        void commitEntry();
+        void writerLoop();
+        void write(Entry &);
+        unsigned char * reserve(size_t size);
+        const bool remap(size_t size);
+        void endRecord(vpVisaRecordType, unsigned char * record, unsigned int payloadSize, long long time);
+
+        std::chrono::steady_clock::time_point start;
+        std::shared_ptr<vpVisaFramePool> frames;
+
+        // ring of entries, filled between tail and head by the producers
+        std::vector<Entry> queue;
+        unsigned int head, tail, reserved;
+        std::mutex queueMutex;
+        std::condition_variable queueCondition;
+        std::thread writer;
+        std::atomic<bool> running;
+
+        // owned by the writer thread
+        int fd;
+        unsigned char * mapping;
+        size_t mappedSize;
+        size_t end; // of the records
+        std::vector<unsigned long long> index; // offset, time
+        std::vector<unsigned char> reference; // previous grey image
+        unsigned int referenceWidth, referenceHeight;
+        unsigned int greyFrame;
+
+        std::atomic<unsigned long long> records, bytes, dropped;
+};
+
+// Record of a log read by vpVisaRecordReader
+struct vpVisaRecord
+{
+    vpVisaRecordType type;
+    long long time;           // ns since the start of the recording
+    std::string name;         // command or query
+    std::vector<double> values;
+    const unsigned char * data; // encoded or grey image, valid while the log is open
+    unsigned int size;
+    unsigned int width, height; // grey image
+};
+
+// Memory mapped reading of a session log, in any order. Grey images are
+// rebuilt from the previous key frame unless read in turn.
+class vpVisaRecordReader
+{
+    public:
+        vpVisaRecordReader();
+        ~vpVisaRecordReader();
+
+        const bool open(const std::string & path);
+        void close();
+
+        unsigned int size() const { return offsets.size(); }
+        // wall clock at the start of the recording, ns since the epoch
+        long long getStartTime() const { return startTime; }
+        // a grey image is rebuilt unless decodeGrey is false, data is then its
+        // GETIMAGEDELTA payload
+        const bool read(unsigned int i, vpVisaRecord &, bool decodeGrey = true);
+
+    private:
+        const bool readGrey(unsigned int i);
+        vpVisaRecordType typeOf(unsigned int i) const;
+
+        int fd;
+        const unsigned char * mapping;
+        size_t mappedSize;
+        long long startTime;
+        std::vector<unsigned long long> offsets;
+        std::vector<long long> times;
+        std::vector<unsigned char> grey;
+        unsigned int greyWidth, greyHeight, greyFrame;
+        int greyRecord; // record held in grey, -1 for none
+};
+
+#endif // VP_VISA_RECORDER_H
@@ -0,0 +1,146 @@
+#include "vpVisaReplay.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "vpVisaLog.h"
+
+vpVisaReplay::vpVisaReplay()
+    : nextFrame(0), maxDeviation(0), unmatched(0)
+{
+}
+
+const bool vpVisaReplay::open(const std::string & path)
+{
+    this->close();
+    if (!reader.open(path)) return false;
+
+    vpVisaRecord r;
+    for (unsigned int i = 0; i < reader.size(); i++){
+        // the type and name only, without rebuilding the grey images
+        if (!reader.read(i, r, false)) continue;
+        if (r.type == VISA_RECORD_REPLY) replies[r.name].records.push_back(i);
+        else if (r.type == VISA_RECORD_COMMAND) commands[r.name].records.push_back(i);
+        else frames.push_back(i);
+    }
+    this->rewind();
+    return true;
+}
+
+void vpVisaReplay::close()
+{
+    reader.close();
+    replies.clear();
+    commands.clear();
+    frames.clear();
+    this->rewind();
+}
+
+void vpVisaReplay::rewind()
+{
+    for (auto & stream : replies) stream.second.next = 0;
+    for (auto & stream : commands) stream.second.next = 0;
+    nextFrame = 0;
+    maxDeviation = 0;
+    unmatched = 0;
+}
+
+const bool vpVisaReplay::query(const char * name, std::vector<double> & values)
+{
+    auto stream = replies.find(name);
+    if (stream == replies.end() || stream->second.records.empty()){
+        VISA_LOG(VISA_LOG_ERROR, "ERROR: no %s in the recording", name);
+        values.clear();
+        return false;
+    }
+    Stream & s = stream->second;
+    unsigned int i = std::min<unsigned int>(s.next, s.records.size() - 1);
+    if (s.next < s.records.size()) s.next++;
+    if (!reader.read(s.records[i], record)) return false;
+    values.assign(record.values.begin(), record.values.end());
+    return true;
+}
+
+const bool vpVisaReplay::command(const char * name, const std::vector<double> & values, unsigned int skip)
+{
+    auto stream = commands.find(name);
+    if (stream == commands.end() || stream->second.next >= stream->second.records.size()){
+        unmatched++;
+        return true;
+    }
+    Stream & s = stream->second;
+    if (!reader.read(s.records[s.next++], record)) return false;
+    // skip: leading values of the recorded command that are not compared (TICK mask)
+    if (record.values.size() != values.size() + skip){
+        unmatched++;
+        return true;
+    }
+    for (size_t k = 0; k < values.size(); k++){
+        maxDeviation = std::max(maxDeviation, fabs(values[k] - record.values[k + skip]));
+    }
+    return true;
+}
+
+const bool vpVisaReplay::tick(const std::vector<double> & velocities, unsigned int request, vpVisaRobotState & state)
+{
+    request &= VISA_STATE_ALL;
+    state.mask = 0;
+
+    auto stream = replies.find("TICK");
+    if (stream != replies.end() && !stream->second.records.empty()){
+        this->command("TICK", velocities, 1);
+        std::vector<double> values;
+        return this->query("TICK", values) && unpackTick(request, values, state);
+    }
+
+    // recorded with separate requests
+    static const char * queries[] = { "GETJOINTPOS", "GETTOOLPOS", "GETJACOBIAN" };
+    std::vector<double> * quantities[] = { &state.jointPos, &state.toolPos, &state.jacobian };
+    if (!velocities.empty()) this->setJointVel(velocities);
+    for (int i = 0; i < 3; i++){
+        if ((request & (1 << i)) && this->query(queries[i], *quantities[i])) state.mask |= 1 << i;
+    }
+    return state.mask == request;
+}
+
+const bool vpVisaReplay::nextFrameRecord()
+{
+    if (nextFrame >= frames.size()) return false;
+    return reader.read(frames[nextFrame++], record);
+}
+
+const bool vpVisaReplay::getImage(const unsigned char * & data, unsigned int & size)
+{
+    if (!this->nextFrameRecord() || record.type != VISA_RECORD_IMAGE){
+        data = NULL;
+        size = 0;
+        return false;
+    }
+    data = record.data;
+    size = record.size;
+    return true;
+}
+
+#if defined(WITH_OPENCV) && defined(WITH_VISP)
+const bool vpVisaReplay::getImageViSP(vpImage<unsigned char> & I)
+{
+    if (!this->nextFrameRecord()) return false;
+
+    if (record.type == VISA_RECORD_GREY){
+        if (I.getHeight() != record.height || I.getWidth() != record.width) I.resize(record.height, record.width);
+        memcpy(I.bitmap, record.data, record.size);
+        return true;
+    }
+
+    // decoded from the log, into I when its size matches
+    cv::Mat encoded(1, record.size, CV_8UC1, (void*)record.data); // header only, no copy
+    cv::Mat grey(I.getHeight(), I.getWidth(), CV_8UC1, I.bitmap);
+    cv::imdecode(encoded, cv::IMREAD_GRAYSCALE, &grey);
+    if (grey.empty()) return false;
+    if (grey.data != I.bitmap){
+        I.resize(grey.rows, grey.cols);
+        memcpy(I.bitmap, grey.data, (size_t)grey.rows * grey.cols);
+    }
+    return true;
+}
+#endif
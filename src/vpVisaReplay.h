@@ -0,0 +1,80 @@
+#ifndef VP_VISA_REPLAY_H
+#define VP_VISA_REPLAY_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "vpVisaBackend.h"
+#include "vpVisaRecorder.h"
+
+// Plays a session log (vpVisaAdapter::startRecording()) back through the
+// vpVisaBackend interface, as fast as it is asked, to run the control code
+// offline.
+//
+// Each kind of query is answered by its recorded replies in turn, the last
+// one again once they are exhausted. Images are served in turn from every
+// image recorded, encoded or grey, and fail at the end of the log. Commands
+// change nothing: they are compared with the ones recorded at the same rank.
+class vpVisaReplay : public vpVisaBackend
+{
+    public:
+        vpVisaReplay();
+
+        const bool open(const std::string & path);
+        void close();
+        // back to the first record of every kind
+        void rewind();
+        // every image was served
+        const bool isFinished() const { return nextFrame >= frames.size(); }
+        unsigned int getFrameCount() const { return frames.size(); }
+
+        // largest difference between a command and the recorded one
+        double getMaxCommandDeviation() const { return maxDeviation; }
+        // commands without a recorded counterpart
+        unsigned int getUnmatchedCommands() const { return unmatched; }
+
+        const bool setJointPosAbs(std::vector<double> joints){ return this->command("SETJOINTPOSABS", joints); }
+        const bool setJointPosRel(std::vector<double> joints){ return this->command("SETJOINTPOSREL", joints); }
+        const bool setJointVel(std::vector<double> velocities){ return this->command("SETJOINTVEL", velocities); }
+        const bool homing(){ return this->command("HOMING", std::vector<double>()); }
+
+        void getJointPos(std::vector<double> & values){ this->query("GETJOINTPOS", values); }
+        void getToolTransform(std::vector<double> & values){ this->query("GETTOOLPOS", values); }
+        void getCalibMatrix(std::vector<double> & values){ this->query("GETCALIBMAT", values); }
+        void getJacobian(std::vector<double> & values){ this->query("GETJACOBIAN", values); }
+        const bool tick(const std::vector<double> & velocities, unsigned int request, vpVisaRobotState & state);
+
+        // zero-copy: data points into the log, false for a grey image
+        const bool getImage(const unsigned char * & data, unsigned int & size);
+
+        #if defined(WITH_OPENCV) && defined(WITH_VISP)
+            // the next image, decoded or copied into I
+            const bool getImageViSP(vpImage<unsigned char> &);
+            const bool getImageBWViSP(vpImage<unsigned char> & I){ return this->getImageViSP(I); }
+            // the whole next image
+            const bool getImageROI(vpImage<unsigned char> & I, const std::vector<vpRect> &){ return this->getImageViSP(I); }
+        #endif
+
+    private:
+        struct Stream
+        {
+            std::vector<unsigned int> records;
+            unsigned int next;
+        };
+
+        const bool query(const char * name, std::vector<double> & values);
+        const bool command(const char * name, const std::vector<double> & values, unsigned int skip = 0);
+        const bool nextFrameRecord();
+
+        vpVisaRecordReader reader;
+        vpVisaRecord record; // reused, its storage with it
+        std::map<std::string, Stream> replies;
+        std::map<std::string, Stream> commands;
+        std::vector<unsigned int> frames;
+        unsigned int nextFrame;
+        double maxDeviation;
+        unsigned int unmatched;
+};
+
+#endif // VP_VISA_REPLAY_H
@@ -0,0 +1,86 @@
+#ifndef VP_VISA_TRACKING_STAGE_H
+#define VP_VISA_TRACKING_STAGE_H
+
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include "vpVisaLatency.h"
+#include "vpVisaWorkerPool.h"
+
+// Tracks independent features of an image in parallel, on a vpVisaWorkerPool.
+//
+// A Tracker is anything with a track(image) method, vpDot2 for instance,
+// which throws or returns false when the feature is lost. The trackers are
+// the caller's: feature i is trackers[i] whichever thread tracked it, and
+// they are read only once track() has returned. The time taken by each
+// feature is recorded.
+template <class Tracker>
+class vpVisaTrackingStage
+{
+    public:
+        // worker threads besides the calling one, -1: one per other hardware thread
+        explicit vpVisaTrackingStage(int threads = -1) : pool(threads) {}
+
+        // false when one of the features is lost, see isTracked()
+        template <class Image>
+        const bool track(const Image & I, Tracker * trackers, unsigned int count)
+        {
+            // grows outside of the parallel section only
+            while (timing.size() < count) timing.emplace_back();
+            tracked.assign(count, 0);
+
+            pool.run(count, [&](unsigned int i){
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                tracked[i] = trackOne(trackers[i], I);
+                timing[i].record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - start).count());
+            });
+
+            for (unsigned int i = 0; i < count; i++){
+                if (!tracked[i]) return false;
+            }
+            return true;
+        }
+        template <class Image>
+        const bool track(const Image & I, std::vector<Tracker> & trackers)
+        {
+            return this->track(I, trackers.data(), trackers.size());
+        }
+
+        // outcome of feature i in the last track()
+        const bool isTracked(unsigned int i) const { return i < tracked.size() && tracked[i]; }
+        // time taken by feature i since the first track() or resetStats()
+        const vpVisaLatency getTiming(unsigned int i) const { return timing[i].summarize(); }
+        void resetStats(){ for (size_t i = 0; i < timing.size(); i++) timing[i].reset(); }
+        unsigned int getThreadCount() const { return pool.size(); }
+
+    private:
+        // track() returning void or bool
+        template <class Image>
+        static const bool trackOne(Tracker & tracker, const Image & I)
+        {
+            try {
+                return succeeded(tracker, I, 0);
+            } catch (...) {
+                return false;
+            }
+        }
+        template <class Image>
+        static auto succeeded(Tracker & tracker, const Image & I, int) -> decltype(bool(tracker.track(I)))
+        {
+            return tracker.track(I);
+        }
+        template <class Image>
+        static const bool succeeded(Tracker & tracker, const Image & I, long)
+        {
+            tracker.track(I);
+            return true;
+        }
+
+        vpVisaWorkerPool pool;
+        std::vector<char> tracked;          // char: written from several threads
+        std::deque<vpVisaHistogram> timing; // not movable, never reallocated
+};
+
+#endif // VP_VISA_TRACKING_STAGE_H
@@ -0,0 +1,80 @@
+#include "vpVisaWorkerPool.h"
+
+vpVisaWorkerPool::vpVisaWorkerPool(int threads)
+    : stopping(false), task(NULL), count(0), generation(0), busy(0), next(0), remaining(0)
+{
+    if (threads < 0){
+        unsigned int hardware = std::thread::hardware_concurrency();
+        threads = hardware > 1 ? hardware - 1 : 0;
+    }
+    for (int i = 0; i < threads; i++) workers.push_back(std::thread(&vpVisaWorkerPool::work, this));
+}
+
+vpVisaWorkerPool::~vpVisaWorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+void vpVisaWorkerPool::run(unsigned int count, const std::function<void(unsigned int)> & task)
+{
+    if (workers.empty() || count < 2){
+        for (unsigned int i = 0; i < count; i++) task(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = &task;
+        this->count = count;
+        next = 0;
+        remaining = count;
+        generation++;
+    }
+    wake.notify_all();
+    this->drain(task, count);
+
+    // no worker may still hold the task once it goes out of scope
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this](){ return remaining == 0 && busy == 0; });
+    this->task = NULL;
+}
+
+void vpVisaWorkerPool::work()
+{
+    unsigned long long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true){
+        wake.wait(lock, [&](){ return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        // woken after the run is over: nothing left to take
+        if (task == NULL) continue;
+
+        const std::function<void(unsigned int)> & current = *task;
+        unsigned int total = count;
+        busy++;
+        lock.unlock();
+        this->drain(current, total);
+        lock.lock();
+        busy--;
+        if (busy == 0 && remaining == 0) done.notify_one();
+    }
+}
+
+void vpVisaWorkerPool::drain(const std::function<void(unsigned int)> & task, unsigned int count)
+{
+    unsigned int i;
+    while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count){
+        task(i);
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            // the last index, the caller may be waiting for it
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef VP_VISA_WORKER_POOL_H
+#define VP_VISA_WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent threads for the data parallel stages of a servo cycle.
+//
+// run() spreads the indices of a task over the workers and the calling
+// thread and returns when all of them are done. The threads are started once,
+// nothing is allocated per call. One run() at a time.
+class vpVisaWorkerPool
+{
+    public:
+        // threads besides the calling one, -1: one per other hardware thread
+        explicit vpVisaWorkerPool(int threads = -1);
+        ~vpVisaWorkerPool();
+
+        // threads taking part in run(), the calling one included
+        unsigned int size() const { return workers.size() + 1; }
+
+        // task(i) for i in [0, count), from any of the threads. The task must
+        // not throw.
+        void run(unsigned int count, const std::function<void(unsigned int)> & task);
+
+    private:
+        void work();
+        void drain(const std::function<void(unsigned int)> & task, unsigned int count);
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        bool stopping;
+
+        // current run, under mutex
+        const std::function<void(unsigned int)> * task;
+        unsigned int count;
+        unsigned long long generation;
+        unsigned int busy; // workers inside the task
+
+        std::atomic<unsigned int> next;
+        std::atomic<unsigned int> remaining;
+};
+
+#endif // VP_VISA_WORKER_POOL_H
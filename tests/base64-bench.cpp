@@ -0,0 +1,162 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <string.h>
+
+#include <cpp-base64/base64.h>
+
+// Throughput of the base64 decoding kernels on image payloads, as received by
+// vpVisaAdapter::getImage() ("data:image/...;base64," followed by the data).
+//
+// usage: base64-bench [image.jpg|image.png ...]
+// Without arguments, synthetic 640x480 JPEG and PNG sized payloads are used.
+
+// Original character by character decoder, kept as the reference.
+static std::vector<unsigned char> reference_decode(const char * encoded_string, unsigned int len)
+{
+    static const std::string base64_chars =
+                 "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                 "abcdefghijklmnopqrstuvwxyz"
+                 "0123456789+/";
+    int in_len = len;
+    int i = 0;
+    int j = 0;
+    int in_ = 0;
+    unsigned char char_array_4[4], char_array_3[3];
+    std::vector<unsigned char> ret;
+
+    while (in_len-- && ( encoded_string[in_] != '=') &&
+           (isalnum((unsigned char)encoded_string[in_]) || encoded_string[in_] == '+' || encoded_string[in_] == '/')) {
+        char_array_4[i++] = encoded_string[in_]; in_++;
+        if (i ==4) {
+            for (i = 0; i <4; i++)
+                char_array_4[i] = base64_chars.find(char_array_4[i]);
+
+            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+            for (i = 0; (i < 3); i++)
+                ret.push_back(char_array_3[i]);
+            i = 0;
+        }
+    }
+
+    if (i) {
+        for (j = i; j <4; j++)
+            char_array_4[j] = 0;
+
+        for (j = 0; j <4; j++)
+            char_array_4[j] = base64_chars.find(char_array_4[j]);
+
+        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+        for (j = 0; (j < i - 1); j++) ret.push_back(char_array_3[j]);
+    }
+
+    return ret;
+}
+
+struct Payload
+{
+    std::string name;
+    std::string encoded; // data URI as sent by the simulator
+    unsigned int start;  // offset of the base64 data
+};
+
+static Payload makePayload(const std::string & name, const std::vector<unsigned char> & raw, bool png)
+{
+    Payload p;
+    p.name = name;
+    p.encoded = png ? "data:image/png;base64," : "data:image/jpeg;base64,";
+    p.start = p.encoded.size();
+    p.encoded += base64_encode(raw.data(), raw.size());
+    return p;
+}
+
+// Entropy coded data is close to random, only the headers are realistic.
+static std::vector<unsigned char> syntheticImage(bool png, size_t size, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<unsigned char> raw(size);
+    for (auto & c : raw) c = (unsigned char)rng();
+    const unsigned char jpegHeader[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00};
+    const unsigned char pngHeader[] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+    if (png) memcpy(raw.data(), pngHeader, sizeof(pngHeader));
+    else     memcpy(raw.data(), jpegHeader, sizeof(jpegHeader));
+    return raw;
+}
+
+template <typename F>
+static double measureMBs(const Payload & p, int iterations, F decode)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) decode();
+    auto duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (double)(p.encoded.size() - p.start) * iterations / duration / 1e6;
+}
+
+int main(int argc, char ** argv)
+{
+    std::vector<Payload> payloads;
+    for (int a = 1; a < argc; a++) {
+        std::ifstream file(argv[a], std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR: cannot open " << argv[a] << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::vector<unsigned char> raw((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::string name(argv[a]);
+        bool png = name.size() > 4 && name.compare(name.size() - 4, 4, ".png") == 0;
+        payloads.push_back(makePayload(name, raw, png));
+    }
+    if (payloads.empty()) {
+        payloads.push_back(makePayload("synthetic jpeg 640x480", syntheticImage(false, 60 * 1024, 1), false));
+        payloads.push_back(makePayload("synthetic png 640x480", syntheticImage(true, 250 * 1024, 2), true));
+        payloads.push_back(makePayload("synthetic odd length", syntheticImage(false, 12345, 3), false));
+    }
+
+    const base64_kernel kernels[] = {BASE64_KERNEL_SCALAR, BASE64_KERNEL_SSE41, BASE64_KERNEL_AVX2};
+    const int iterations = 200;
+    bool identical = true;
+
+    for (const auto & p : payloads) {
+        const char * data = p.encoded.data() + p.start;
+        unsigned int len = p.encoded.size() - p.start;
+        std::vector<unsigned char> expected = reference_decode(data, len);
+        std::vector<unsigned char> out(base64_decoded_size(len));
+
+        std::cout << p.name << " (" << len << " chars)" << std::endl;
+        double mbs = measureMBs(p, iterations, [&]() { reference_decode(data, len); });
+        std::cout << "  " << std::setw(10) << "reference" << std::fixed << std::setprecision(1)
+                  << std::setw(10) << mbs << " MB/s" << std::endl;
+
+        for (auto kernel : kernels) {
+            if (!base64_kernel_supported(kernel)) {
+                std::cout << "  " << std::setw(10) << base64_kernel_name(kernel) << "  not supported" << std::endl;
+                continue;
+            }
+
+            unsigned int n = base64_decode_into(data, len, out.data(), out.size(), kernel);
+            bool same = n == expected.size() && memcmp(out.data(), expected.data(), n) == 0;
+
+            // in-place decoding, as done on the receive buffer
+            std::string copy(data, len);
+            unsigned int m = base64_decode_into(&copy[0], len, (unsigned char *)&copy[0], len, kernel);
+            same = same && m == expected.size() && memcmp(copy.data(), expected.data(), m) == 0;
+            identical = identical && same;
+
+            mbs = measureMBs(p, iterations, [&]() { base64_decode_into(data, len, out.data(), out.size(), kernel); });
+            std::cout << "  " << std::setw(10) << base64_kernel_name(kernel) << std::setw(10) << mbs << " MB/s"
+                      << (same ? "" : "  OUTPUT DIFFERS") << std::endl;
+        }
+    }
+
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
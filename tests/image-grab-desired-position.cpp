@@ -49,7 +49,7 @@ int main ()
         //t = vpTime::measureTimeMs();
         startTime_ = std::chrono::system_clock::now();      
 
-        I = adapter->getImageViSP();
+        adapter->getImageViSP(I);
 
         vpDisplay::display(I);
         vpDisplay::displayCharString(I, 10, 10, "Mouse right click on the image to select feature points ...",vpColor::orange);
@@ -0,0 +1,676 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include <memory>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "vpVisaAdapter.h"
+#include "vpVisaAdapterPool.h"
+#include "vpVisaFixedKinematics.h"
+#include "vpVisaPeriodic.h"
+#include "vpVisaReplay.h"
+#include "vpVisaSimStub.h"
+#include "vpVisaTrackingStage.h"
+
+#ifdef WITH_VISP
+#include <visp3/robot/vpViper650.h>
+#endif
+
+// Latency and throughput of every vpVisaAdapter entry point against a local
+// loopback server (an in-process vpVisaSimStub on a free port unless --port
+// is given), and of the local stages of the image and reply processing. The
+// session logs go to a temporary directory, removed at the end. Any failed
+// consistency check fails the run.
+//
+// usage: visa-bench [--iterations N] [--json visa-bench.json] [--label name]
+//                   [--port P (use a server already listening on 127.0.0.1:P)]
+
+// reply parsing before vpVisaProtocol::parseText, for comparison
+static void legacyParseCsv(const char * text, std::vector<double> & values)
+{
+    std::string str(text);
+    str.erase(str.find_last_not_of("\t\n\v\f\r_ ") + 1);
+    std::vector<std::string> valuesStr;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) valuesStr.push_back(item);
+
+    values.resize(valuesStr.size());
+    for (size_t i = 0; i < values.size(); i++){
+        values[i] = std::stof(valuesStr[i]);
+    }
+}
+
+// grey image for the stand-in tracker
+struct GreyView
+{
+    const unsigned char * data;
+    unsigned int width;
+    unsigned int height;
+};
+
+// vpDot2 stand-in: centroid of the dark pixels of a window, which then
+// follows the blob at three times its size
+struct BlobTracker
+{
+    double u, v;
+    int left, top, size;
+
+    void init(int left, int top, int size){ this->left = left; this->top = top; this->size = size; u = v = 0; }
+    const bool track(const GreyView & I)
+    {
+        double su = 0, sv = 0, n = 0;
+        for (int y = std::max(0, top); y < std::min((int)I.height, top + size); y++){
+            const unsigned char * row = I.data + (size_t)y * I.width;
+            for (int x = std::max(0, left); x < std::min((int)I.width, left + size); x++){
+                if (row[x] < 128){ su += x; sv += y; n++; }
+            }
+        }
+        if (n == 0) return false;
+        u = su / n;
+        v = sv / n;
+        double radius = sqrt(n / M_PI);
+        size = 6 * radius + 1;
+        left = u - 3 * radius;
+        top = v - 3 * radius;
+        return true;
+    }
+};
+
+struct BenchResult
+{
+    std::string name;
+    std::vector<double> durations; // us, sorted
+    double bytesPerCall;
+};
+
+class Bench
+{
+    public:
+        Bench(int iterations) : iterations(iterations) {}
+
+        // bytesPerCall gives a MB/s throughput when the call processes a buffer
+        void run(const std::string & name, const std::function<void()> & call, double bytesPerCall = 0)
+        {
+            BenchResult result;
+            result.name = name;
+            result.bytesPerCall = bytesPerCall;
+            result.durations.resize(iterations);
+
+            // anything printed while measuring is not shown
+            std::ostringstream sink;
+            std::streambuf * console = std::cout.rdbuf(sink.rdbuf());
+            for (int i = 0; i < 10; i++) call(); // warm up
+            for (int i = 0; i < iterations; i++){
+                auto start = std::chrono::steady_clock::now();
+                call();
+                result.durations[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+                if (sink.tellp() > (1 << 20)) sink.str("");
+            }
+            std::cout.rdbuf(console);
+
+            std::sort(result.durations.begin(), result.durations.end());
+            results.push_back(result);
+            print(result);
+        }
+
+        bool writeJson(const std::string & file, const std::string & label) const
+        {
+            std::ofstream out(file.c_str());
+            if (!out) return false;
+
+            char date[32];
+            time_t now = time(NULL);
+            strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+            out << std::fixed << std::setprecision(3);
+            out << "{\n  \"label\": \"" << label << "\",\n  \"date\": \"" << date << "\",\n"
+                << "  \"iterations\": " << iterations << ",\n  \"unit\": \"us\",\n  \"results\": [\n";
+            for (size_t i = 0; i < results.size(); i++){
+                const BenchResult & r = results[i];
+                out << "    {\"name\": \"" << r.name << "\""
+                    << ", \"mean\": " << mean(r)
+                    << ", \"p50\": " << percentile(r, 50)
+                    << ", \"p99\": " << percentile(r, 99)
+                    << ", \"max\": " << r.durations.back()
+                    << ", \"calls_per_s\": " << 1e6 / mean(r);
+                if (r.bytesPerCall > 0) out << ", \"mb_per_s\": " << r.bytesPerCall / mean(r);
+                out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+            }
+            out << "  ]\n}\n";
+            return true;
+        }
+
+    private:
+        static double mean(const BenchResult & r)
+        {
+            double sum = 0;
+            for (auto d : r.durations) sum += d;
+            return sum / r.durations.size();
+        }
+
+        static double percentile(const BenchResult & r, int p)
+        {
+            return r.durations[std::min(r.durations.size() - 1, r.durations.size() * p / 100)];
+        }
+
+        static void print(const BenchResult & r)
+        {
+            std::cout << "  " << std::left << std::setw(28) << r.name << std::right << std::fixed << std::setprecision(1)
+                      << " p50 " << std::setw(9) << percentile(r, 50)
+                      << "  p99 " << std::setw(9) << percentile(r, 99)
+                      << "  max " << std::setw(9) << r.durations.back() << " us"
+                      << "  " << std::setw(9) << 1e6 / mean(r) << " calls/s";
+            if (r.bytesPerCall > 0) std::cout << "  " << std::setw(8) << r.bytesPerCall / mean(r) << " MB/s";
+            std::cout << std::endl;
+        }
+
+        int iterations;
+        std::vector<BenchResult> results;
+};
+
+// a fresh directory under /tmp, removed with the files named by file()
+class TemporaryDirectory
+{
+    public:
+        TemporaryDirectory()
+        {
+            char name[] = "/tmp/visa-bench-XXXXXX";
+            if (mkdtemp(name) != NULL) path = name;
+        }
+        ~TemporaryDirectory()
+        {
+            for (const auto & file : files) ::remove(file.c_str());
+            if (!path.empty()) ::rmdir(path.c_str());
+        }
+        bool created() const { return !path.empty(); }
+        std::string file(const std::string & name)
+        {
+            files.push_back(path + "/" + name);
+            return files.back();
+        }
+
+    private:
+        std::string path;
+        std::vector<std::string> files;
+};
+
+int main(int argc, char ** argv)
+{
+    int iterations = 1000;
+    std::string json = "visa-bench.json";
+    std::string label = "visa-visp";
+    unsigned int port = 0;
+    for (int i = 1; i + 1 < argc; i += 2){
+        std::string option(argv[i]);
+        if (option == "--iterations") iterations = std::max(1, atoi(argv[i+1]));
+        else if (option == "--json") json = argv[i+1];
+        else if (option == "--label") label = argv[i+1];
+        else if (option == "--port") port = atoi(argv[i+1]);
+        else {
+            std::cerr << "usage: " << argv[0] << " [--iterations N] [--json file] [--label name] [--port P]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the consistency checks along the way, any mismatch fails the run
+    bool failed = false;
+    auto check = [&failed](bool ok, const char * what){
+        if (!ok){
+            std::cerr << "FAILED: " << what << std::endl;
+            failed = true;
+        }
+    };
+
+    vpVisaSimStub stub;
+    if (port == 0){
+        if (!stub.start("127.0.0.1", 0)) return EXIT_FAILURE;
+        port = stub.getPort();
+    }
+
+    // a simulator that does not answer fails the run at once
+    vpVisaAdapter adapter;
+    std::vector<double> calibration;
+    if (adapter.connect("127.0.0.1", port)) adapter.getCalibMatrix(calibration);
+    if (calibration.empty()){
+        std::cerr << "ERROR: no simulator answering on 127.0.0.1:" << port << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    TemporaryDirectory directory;
+    if (!directory.created()){
+        std::cerr << "ERROR: cannot create a temporary directory" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string recordPath = directory.file("visa-bench.rec");
+    const std::string replayPath = directory.file("visa-bench-replay.rec");
+    Bench bench(iterations);
+
+    // keep one reply and one image for the local stages
+    std::vector<unsigned char> encodedImage = adapter.getImage();
+    std::string payload = "data:image/jpeg;base64," + base64_encode(encodedImage.data(), encodedImage.size());
+    std::string reply; // as the simulator formats a GETTOOLPOS answer
+    std::vector<double> fMe;
+    adapter.getToolTransform(fMe);
+    for (size_t i = 0; i < fMe.size(); i++){
+        char number[32];
+        snprintf(number, sizeof(number), "%s%.9g", i ? "," : "", fMe[i]);
+        reply += number;
+    }
+
+    std::cout << "adapter, text protocol" << std::endl;
+    std::vector<double> values;
+    std::vector<double> velocities(6, 0.0);
+    bench.run("getImage", [&](){ adapter.getImage(); }, encodedImage.size());
+    bench.run("getImage/zero-copy", [&](){
+        const unsigned char * data; unsigned int size;
+        adapter.getImage(data, size);
+    }, encodedImage.size());
+    vpVisaFrame frame;
+    bench.run("getImage/frame", [&](){ adapter.getImage(frame); }, encodedImage.size());
+    bench.run("getImageBW/frame", [&](){ adapter.getImageBW(frame); });
+    frame.release();
+    #ifdef WITH_OPENCV
+        bench.run("getImageBWOpenCV", [&](){ adapter.getImageBWOpenCV(); });
+        cv::Mat colour;
+        bench.run("getImageOpenCV", [&](){ adapter.getImageOpenCV(colour); });
+    #endif
+    #if defined(WITH_OPENCV) && defined(WITH_VISP)
+        vpImage<unsigned char> I;
+        bench.run("getImageViSP", [&](){ adapter.getImageViSP(I); });
+        // four 99x99 windows, about three times the size of the stand-in dots
+        std::vector<vpRect> windows;
+        for (int k = 0; k < 4; k++) windows.push_back(vpRect(100 + 200 * (k % 2), 100 + 200 * (k / 2), 99, 99));
+        bench.run("getImageROI", [&](){ adapter.getImageROI(I, windows); }, 4 * 99 * 99);
+    #endif
+    bench.run("getJointPos/text", [&](){ adapter.getJointPos(values); });
+    bench.run("getToolTransform/text", [&](){ adapter.getToolTransform(values); });
+    bench.run("getCalibMatrix/text", [&](){ adapter.getCalibMatrix(values); });
+    #ifdef WITH_VISP
+        bench.run("get_fJe/text", [&](){ adapter.get_fJe(); });
+        bench.run("get_eJe/text", [&](){ adapter.get_eJe(); });
+    #endif
+    bench.run("setJointVel/text", [&](){ adapter.setJointVel(velocities); });
+    vpVisaRobotState state;
+    bench.run("cycle/separate/text", [&](){
+        adapter.setJointVel(velocities);
+        adapter.getJointPos(state.jointPos);
+        adapter.getToolTransform(state.toolPos);
+    });
+    bench.run("cycle/tick/text", [&](){ adapter.tick(velocities, VISA_STATE_JOINTPOS | VISA_STATE_TOOLPOS, state); });
+
+    // the arm of the stub, fMe and fJe computed from q
+    #ifdef WITH_VISP
+        auto model = std::make_shared<vpVisaViSPModel<vpViper650> >();
+    #else
+        // cartesian: translations along x, y, z then rotations about x, y, z
+        auto model = std::make_shared<vpVisaDhModel>();
+        for (int i = 0; i < 6; i++){
+            model->addJoint(i < 3 ? vpVisaDhModel::PRISMATIC : vpVisaDhModel::REVOLUTE,
+                            i < 5 ? M_PI / 2 : 0, 0, 0, i < 5 ? M_PI / 2 : 0);
+        }
+        model->setBaseTransform({0, 1, 0, 0,  0, 0, 1, 0,  1, 0, 0, 0,  0, 0, 0, 1});
+    #endif
+    bench.run("state/tick/text", [&](){ adapter.tick(velocities, VISA_STATE_ALL, state); });
+    adapter.setKinematicModel(model, 100);
+    bench.run("state/tick/local/text", [&](){ adapter.tick(velocities, VISA_STATE_ALL, state); });
+    vpVisaKinematicsStats kinematics = adapter.getKinematicsStats();
+    std::cout << "  local kinematics: " << kinematics.computed << " computed, " << kinematics.checks << " checks, "
+              << kinematics.drifts << " drifts, max error fMe " << std::scientific << kinematics.maxToolError
+              << ", fJe " << kinematics.maxJacobianError << std::fixed << std::endl;
+    check(kinematics.drifts == 0, "local kinematics drift from the simulator");
+    adapter.setKinematicModel(NULL);
+
+    // twist and jacobian math on the last state, no allocation
+    vpVisaPose pose;
+    vpVisaFixedKinematics<6>::Jacobian fJe, eJe;
+    vpVisaFixedKinematics<6>::JacobianInverse eJe_inv;
+    vpVisaFixedKinematics<6>::fromState(state, pose, fJe);
+    bench.run("eJe/fixed", [&](){ vpVisaFixedKinematics<6>::get_eJe(pose, fJe, eJe); });
+    bench.run("pseudoInverse/fixed", [&](){ vpVisaFixedKinematics<6>::pseudoInverse(eJe, eJe_inv, 1e-3); });
+    #ifdef WITH_VISP
+        vpMatrix eJe_visp;
+        bench.run("eJe/visp", [&](){ eJe_visp = vpVisaBackend::get_eJe(state); });
+        bench.run("pseudoInverse/visp", [&](){ eJe_visp.pseudoInverse(); });
+    #endif
+    vpVisaFixedKinematics<6>::pseudoInverse(eJe, eJe_inv);
+    vpVisaMat<6, 6> identity;
+    identity.multiply(eJe, eJe_inv);
+    double inverseError = 0;
+    for (unsigned int i = 0; i < 6; i++){
+        for (unsigned int j = 0; j < 6; j++){
+            inverseError = std::max(inverseError, std::fabs(identity(i, j) - (i == j ? 1. : 0.)));
+        }
+    }
+    std::cout << "  eJe eJe^+ - I: " << std::scientific << inverseError << std::fixed << std::endl;
+    check(inverseError < 1e-6, "eJe eJe^+ is not the identity");
+
+    adapter.startVelocityStream();
+    bench.run("streamJointVel", [&](){ adapter.streamJointVel(velocities); });
+    adapter.stopVelocityStream();
+    // delivery, paced as a 2 kHz control loop
+    auto streamPaced = [&](){
+        adapter.startVelocityStream();
+        for (int i = 0; i < 500; i++){
+            adapter.streamJointVel(velocities);
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+        adapter.stopVelocityStream();
+        vpVisaStreamStats stream = adapter.getStreamStats();
+        std::cout << "  streamed at 2 kHz: " << stream.queued << " queued, " << stream.sent << " sent, "
+                  << stream.coalesced << " coalesced, " << stream.failed << " failed, "
+                  << stream.rejected << " rejected" << std::endl;
+        check(stream.failed == 0 && stream.sent + stream.coalesced == stream.queued, "streamed velocities lost");
+    };
+    streamPaced();
+
+    // 1 kHz servo cycle for 0.5 s: relative sleeps as vpTime::wait(t, period),
+    // then absolute deadlines, then absolute deadlines in SCHED_FIFO
+    {
+        const int cycles = 500;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < cycles; i++){
+            auto t = std::chrono::steady_clock::now();
+            adapter.tick(velocities, VISA_STATE_JOINTPOS | VISA_STATE_TOOLPOS, state);
+            std::this_thread::sleep_for(std::chrono::microseconds(1000) - (std::chrono::steady_clock::now() - t));
+        }
+        double drift = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() - cycles;
+        std::cout << "  relative sleeps: " << std::setprecision(2) << drift << " ms late after " << cycles << " cycles" << std::endl;
+        for (int realtime = 0; realtime < 2; realtime++){
+            vpVisaPeriodic loop(1000);
+            if (realtime) loop.setRealtime(50, 0);
+            int remaining = cycles;
+            start = std::chrono::steady_clock::now();
+            loop.run([&](){
+                adapter.tick(velocities, VISA_STATE_JOINTPOS | VISA_STATE_TOOLPOS, state);
+                return --remaining > 0;
+            });
+            drift = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() - (cycles - 1);
+            vpVisaPeriodicStats stats = loop.getStats();
+            std::cout << "  " << (stats.realtime ? "SCHED_FIFO deadlines: " : "absolute deadlines: ") << drift
+                      << " ms late, lateness p50 " << stats.lateness.p50 << " p99 " << stats.lateness.p99
+                      << " max " << stats.lateness.max << " us, " << stats.overruns << " overruns" << std::endl;
+        }
+    }
+
+    if (adapter.setBinaryProtocol(true)){
+        std::cout << "adapter, binary protocol" << std::endl;
+        bench.run("getJointPos/binary", [&](){ adapter.getJointPos(values); });
+        bench.run("getToolTransform/binary", [&](){ adapter.getToolTransform(values); });
+        bench.run("getCalibMatrix/binary", [&](){ adapter.getCalibMatrix(values); });
+        #ifdef WITH_VISP
+            bench.run("get_fJe/binary", [&](){ adapter.get_fJe(); });
+            bench.run("get_eJe/binary", [&](){ adapter.get_eJe(); });
+        #endif
+        bench.run("setJointVel/binary", [&](){ adapter.setJointVel(velocities); });
+        bench.run("cycle/separate/binary", [&](){
+            adapter.setJointVel(velocities);
+            adapter.getJointPos(state.jointPos);
+            adapter.getToolTransform(state.toolPos);
+        });
+        bench.run("cycle/tick/binary", [&](){ adapter.tick(velocities, VISA_STATE_JOINTPOS | VISA_STATE_TOOLPOS, state); });
+        bench.run("state/tick/binary", [&](){ adapter.tick(velocities, VISA_STATE_ALL, state); });
+        adapter.setKinematicModel(model, 100);
+        bench.run("state/tick/local/binary", [&](){ adapter.tick(velocities, VISA_STATE_ALL, state); });
+        adapter.setKinematicModel(NULL);
+        streamPaced();
+        adapter.setBinaryProtocol(false);
+    }
+
+    adapter.setStreamingDecode(true);
+    std::cout << "adapter, streaming decode" << std::endl;
+    bench.run("getImage/streaming", [&](){
+        const unsigned char * data; unsigned int size;
+        adapter.getImage(data, size);
+    }, encodedImage.size());
+    #ifdef WITH_OPENCV
+        bench.run("getImageOpenCV/streaming", [&](){ adapter.getImageOpenCV(colour); });
+    #endif
+    adapter.setStreamingDecode(false);
+    #ifdef WITH_OPENCV
+        // the robot has not moved: the same image decoded whole
+        cv::Mat streamed = colour.clone();
+        adapter.getImageOpenCV(colour);
+        double decodeError = streamed.size() == colour.size() ? cv::norm(streamed, colour, cv::NORM_INF) : 255;
+        std::cout << "  streaming vs whole decode: max error " << decodeError << std::endl;
+        check(decodeError <= 1, "streaming decode differs from the whole image decode");
+    #endif
+
+    // the scene creeps as in a servo loop, each call first moves the robot a little
+    std::cout << "adapter, delta transport" << std::endl;
+    const std::vector<double> step = {0.002, 0.001, 0.0, 0.0, 0.0, 0.002};
+    unsigned long long received[3] = {0, 0, 0};
+    bench.run("getImage/jpeg", [&](){
+        adapter.setJointPosRel(step);
+        adapter.getImage(frame);
+        received[2] += adapter.getLastFrameStats().bytesReceived;
+    });
+    for (int delta = 0; delta < 2; delta++){
+        adapter.setDeltaTransport(delta == 1);
+        bench.run(delta ? "getImageBW/delta" : "getImageBW/full", [&](){
+            adapter.setJointPosRel(step);
+            adapter.getImageBW(frame);
+            received[delta] += adapter.getLastFrameStats().bytesReceived;
+        });
+    }
+    adapter.setDeltaTransport(false);
+    frame.release();
+    std::cout << "  bytes per frame: jpeg " << received[2] / (iterations + 10)
+              << ", full " << received[0] / (iterations + 10)
+              << ", delta " << received[1] / (iterations + 10) << std::endl;
+
+    // a servo cycle with and without the session log
+    std::cout << "adapter, recording" << std::endl;
+    auto servo = [&](){
+        adapter.tick(step, VISA_STATE_ALL, state);
+        adapter.getImageBW(frame);
+    };
+    bench.run("servo cycle", servo);
+    bool recording = adapter.startRecording(recordPath);
+    check(recording, "cannot record the session");
+    if (recording){
+        bench.run("servo cycle/recording", servo);
+        adapter.stopRecording();
+        vpVisaRecorderStats recorded = adapter.getRecordingStats();
+        vpVisaRecordReader reader;
+        vpVisaRecord record;
+        bool same = reader.open(recordPath);
+        for (int i = reader.size() - 1; same && i >= 0; i--){
+            if (!reader.read(i, record)) same = false;
+            else if (record.type == VISA_RECORD_GREY){
+                same = record.size == frame.size() && memcmp(record.data, frame.data(), record.size) == 0;
+                break;
+            }
+        }
+        std::cout << "  recorded " << recorded.records << " records, " << recorded.bytes / 1024 << " KB, "
+                  << recorded.dropped << " dropped, " << reader.size() << " read back, last frame "
+                  << (same ? "identical" : "DIFFERENT") << std::endl;
+        check(same, "recorded frame differs from the last one acquired");
+    }
+    frame.release();
+
+    // the same control code against the simulator, then offline on its recording
+    std::cout << "backends" << std::endl;
+    unsigned long long imageBytes = 0;
+    auto cycle = [&](vpVisaBackend & backend){
+        const unsigned char * data; unsigned int size;
+        backend.tick(step, VISA_STATE_ALL, state);
+        if (backend.getImage(data, size)) imageBytes += size;
+    };
+    recording = adapter.startRecording(replayPath);
+    check(recording, "cannot record the session");
+    if (recording){
+        bench.run("cycle/adapter", [&](){ cycle(adapter); });
+        adapter.stopRecording();
+        unsigned long long recordedBytes = imageBytes;
+        vpVisaReplay replay;
+        bool replaying = replay.open(replayPath);
+        check(replaying, "cannot replay the session");
+        if (replaying){
+            imageBytes = 0;
+            // as many cycles as were recorded
+            bench.run("cycle/replay", [&](){ cycle(replay); });
+            std::cout << "  replayed " << replay.getFrameCount() << " frames, "
+                      << (imageBytes == recordedBytes ? "same" : "DIFFERENT") << " image bytes, velocity deviation "
+                      << replay.getMaxCommandDeviation() << ", " << replay.getUnmatchedCommands()
+                      << " unmatched commands" << std::endl;
+            check(imageBytes == recordedBytes, "replayed images differ from the recorded ones");
+            check(replay.getUnmatchedCommands() == 0, "replayed commands differ from the recorded ones");
+        }
+    }
+
+    #ifdef __linux__
+        // eight simulators 0.2 ms away, one adapter each in turn against one batched pool
+        const unsigned int robots = 8;
+        std::vector<std::unique_ptr<vpVisaSimStub> > stubs;
+        std::vector<std::unique_ptr<vpVisaAdapter> > adapters;
+        vpVisaAdapterPool pool;
+        for (unsigned int r = 0; r < robots; r++){
+            stubs.emplace_back(new vpVisaSimStub());
+            stubs.back()->setImageSize(64, 48);
+            stubs.back()->setLatency(0.2);
+            adapters.emplace_back(new vpVisaAdapter());
+            if (!stubs.back()->start("127.0.0.1", 0) || !adapters.back()->connect("127.0.0.1", stubs.back()->getPort())){
+                std::cerr << "ERROR: cannot start simulator " << r << " of the pool" << std::endl;
+                return EXIT_FAILURE;
+            }
+            pool.add("127.0.0.1", stubs.back()->getPort());
+        }
+        std::cout << "pool of " << robots << " simulators" << std::endl;
+        std::vector<std::vector<double> > positions;
+        const std::vector<std::vector<double> > allVelocities(robots, velocities);
+        for (int binary = 0; binary < 2; binary++){
+            std::string protocol = binary ? "/binary" : "/text";
+            for (auto & a : adapters) a->setBinaryProtocol(binary == 1);
+            bench.run("getJointPos/sequential" + protocol, [&](){
+                for (auto & a : adapters) a->getJointPos(values);
+            });
+            bench.run("setJointVel/sequential" + protocol, [&](){
+                for (auto & a : adapters) a->setJointVel(velocities);
+            });
+            pool.stop();
+            if (!pool.start(binary == 1)){
+                std::cerr << "ERROR: cannot start the pool" << std::endl;
+                return EXIT_FAILURE;
+            }
+            bench.run("getJointPos/pool" + protocol, [&](){ pool.getJointPos(positions); });
+            bench.run("setJointVel/pool" + protocol, [&](){ pool.setJointVel(allVelocities); });
+        }
+        // too many values for a datagram: no request sent, the batch fails at once
+        const std::vector<std::vector<double> > oversized(robots, std::vector<double>(vpVisaProtocol::MAX_VALUES + 1));
+        check(!pool.setJointVel(oversized), "pool accepted arguments too large to encode");
+        pool.stop();
+        for (auto & a : adapters) a->disconnect();
+        for (auto & s : stubs) s->stop();
+    #endif
+
+    std::cout << "local stages" << std::endl;
+    std::vector<unsigned char> decoded(base64_decoded_size(payload.size()));
+    bench.run("base64 decode", [&](){
+        base64_decode_into(payload.data() + 23, payload.size() - 23, decoded.data(), decoded.size());
+    }, payload.size() - 23);
+    bench.run("csv parse/legacy", [&](){ legacyParseCsv(reply.c_str(), values); }, reply.size());
+    double legacyError = 0;
+    for (size_t i = 0; i < values.size() && i < fMe.size(); i++) legacyError = std::max(legacyError, fabs(values[i] - fMe[i]));
+    bench.run("csv parse", [&](){ vpVisaAdapter::parseCsv(reply.c_str(), values); }, reply.size());
+    double parseError = 0;
+    for (size_t i = 0; i < values.size() && i < fMe.size(); i++) parseError = std::max(parseError, fabs(values[i] - fMe[i]));
+    std::cout << "  csv parse max error: legacy " << std::scientific << legacyError
+              << ", parseText " << parseError << std::fixed << std::endl;
+    check(parseError < 1e-12, "parseCsv differs from the values sent");
+    #ifdef WITH_OPENCV
+        cv::Mat encoded(1, encodedImage.size(), CV_8UC1, encodedImage.data());
+        cv::Mat image;
+        bench.run("imdecode", [&](){ cv::imdecode(encoded, cv::IMREAD_COLOR, &image); }, encodedImage.size());
+        cv::Mat greyImage;
+        bench.run("imdecode/grey", [&](){ cv::imdecode(encoded, cv::IMREAD_GRAYSCALE, &greyImage); }, encodedImage.size());
+    #endif
+    #ifdef WITH_JPEG
+        // colour then grey, into reused storage as the adapter does
+        vpJpegStreamDecoder decoder;
+        std::vector<unsigned char> pixels;
+        auto allocator = [&pixels](unsigned int width, unsigned int height,
+                                   unsigned int channels, unsigned int & stride) -> unsigned char * {
+            pixels.resize((size_t)width * height * channels);
+            stride = width * channels;
+            return pixels.data();
+        };
+        bench.run("jpeg decode/colour", [&](){
+            decoder.reset(false, allocator);
+            decoder.feed(encodedImage.data(), encodedImage.size(), true);
+        }, encodedImage.size());
+        bench.run("jpeg decode/grey", [&](){
+            decoder.reset(true, allocator);
+            decoder.feed(encodedImage.data(), encodedImage.size(), true);
+        }, encodedImage.size());
+        // half an image must not pass for a whole one
+        decoder.reset(true, allocator);
+        bool whole = decoder.feed(encodedImage.data(), encodedImage.size(), true) == vpJpegStreamDecoder::DONE;
+        decoder.reset(true, allocator);
+        bool truncated = decoder.feed(encodedImage.data(), encodedImage.size() / 2, true) == vpJpegStreamDecoder::FAILED;
+        std::cout << "  jpeg decode: whole image " << (whole ? "done" : "FAILED") << ", truncated image "
+                  << (truncated ? "failed" : "DONE") << std::endl;
+        check(whole, "streaming decode of a whole image");
+        check(truncated, "streaming decode of a truncated image");
+    #endif
+
+    vpVisaHistogram histogram;
+    bench.run("latency record", [&](){
+        auto start = std::chrono::steady_clock::now();
+        histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    });
+
+    // 4 then 16 blobs, one after the other and through the tracking stage,
+    // with the robot at home each dot is in its own quadrant
+    adapter.homing();
+    adapter.getImageBW(frame);
+    GreyView grey = { frame.data(), frame.getWidth(), frame.getHeight() };
+    vpVisaTrackingStage<BlobTracker> stage(3);
+    for (unsigned int count = 4; count <= 16; count *= 4){
+        // several trackers on each of the four dots, each starting from its quadrant
+        std::vector<BlobTracker> sequential(count), parallel;
+        for (unsigned int k = 0; k < count; k++){
+            sequential[k].init(grey.width / 2 * (k % 2), grey.height / 2 * (k / 2 % 2), grey.height / 2);
+        }
+        parallel = sequential;
+        stage.resetStats();
+        std::string suffix = "/" + std::to_string(count);
+        bench.run("track/sequential" + suffix, [&](){
+            for (auto & tracker : sequential) tracker.track(grey);
+        });
+        bench.run("track/stage" + suffix, [&](){ stage.track(grey, parallel); });
+        double difference = 0;
+        for (unsigned int k = 0; k < count; k++){
+            difference = std::max(difference, std::max(fabs(sequential[k].u - parallel[k].u), fabs(sequential[k].v - parallel[k].v)));
+        }
+        vpVisaLatency first = stage.getTiming(0);
+        std::cout << "  " << count << " blobs on " << stage.getThreadCount() << " threads, feature 0 p50 "
+                  << first.p50 << " us, largest difference with sequential " << difference << " px" << std::endl;
+        check(difference == 0, "tracking stage differs from sequential tracking");
+    }
+    frame.release();
+
+    std::cout << std::endl;
+    adapter.printStats(std::cout);
+    adapter.disconnect();
+    stub.stop();
+
+    if (!bench.writeJson(json, label)){
+        std::cerr << "ERROR: cannot write " << json << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "results written to " << json << std::endl;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
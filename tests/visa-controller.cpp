@@ -1,4 +1,5 @@
 #include "vpVisaAdapter.h"
+#include "vpVisaFixedKinematics.h"
 
 #include <visp3/core/vpConfig.h>
 #include <visp3/core/vpDebug.h> // Debug trace
@@ -49,7 +50,10 @@ int main()
   std::cout << "eMc: \n" << eMc << std::endl;
 
 
-  vpVelocityTwistMatrix cVe(eMc.inverse());
+  vpVisaPose eMc_;
+  eMc_.fromViSP(eMc);
+  // no translation between e and c: cVe is a rotation of both blocks
+  vpVisaPose cMe = eMc_.inverse();
 
 
 
@@ -73,30 +77,16 @@ int main()
     robot.get_eJe(q, eJe);
     robot.get_fJe(q, fJe);
     robot.get_fMe(q, fMe);
-    vpVelocityTwistMatrix tmp(fMe.inverse());
-    vpVelocityTwistMatrix fVe;
-    fVe[0][0] = tmp[0][0];
-    fVe[0][1] = tmp[0][1];
-    fVe[0][2] = tmp[0][2];
-    fVe[1][0] = tmp[1][0];
-    fVe[1][1] = tmp[1][1];
-    fVe[1][2] = tmp[1][2];
-    fVe[2][0] = tmp[2][0];
-    fVe[2][1] = tmp[2][1];
-    fVe[2][2] = tmp[2][2];
-
-    fVe[3][3] = tmp[3][3];
-    fVe[3][4] = tmp[3][4];
-    fVe[3][5] = tmp[3][5];
-    fVe[4][3] = tmp[4][3];
-    fVe[4][4] = tmp[4][4];
-    fVe[4][5] = tmp[4][5];
-    fVe[5][3] = tmp[5][3];
-    fVe[5][4] = tmp[5][4];
-    fVe[5][5] = tmp[5][5];
-
-    std::cout << "fVe: \n" << eJe << std::endl;
-    std::cout << "Difference: \n" << (fVe * fJe - eJe) << std::endl;
+    vpVisaPose fMe_;
+    vpVisaFixedKinematics<6>::Jacobian fJe_, eJe_;
+    fMe_.fromViSP(fMe);
+    fJe_.fromViSP(fJe);
+    vpVisaFixedKinematics<6>::get_eJe(fMe_, fJe_, eJe_);
+    vpMatrix eJe_visa;
+    eJe_.toViSP(eJe_visa);
+
+    std::cout << "eJe: \n" << eJe << std::endl;
+    std::cout << "Difference: \n" << (eJe_visa - eJe) << std::endl;
 
     // std::cout << "eJe VISP: \n" << eJe << std::endl;
     // auto fMe = adapter->get_fMe();
@@ -114,11 +104,18 @@ int main()
 
 
 
-    vpColVector q_dot = (cVe * eJe).pseudoInverse() * v;
+    vpVisaFixedKinematics<6>::Jacobian cJe;
+    vpVisaFixedKinematics<6>::JacobianInverse cJe_inv;
+    vpVisaFixedKinematics<6>::changeFrame(cMe.R, eJe_, cJe);
+    // damped at a singular pose, zero velocity if even that fails
+    if (!vpVisaFixedKinematics<6>::pseudoInverse(cJe, cJe_inv))
+      vpVisaFixedKinematics<6>::pseudoInverse(cJe, cJe_inv, 1e-3);
 
-    std::vector<double> q_dot_;
-    for (unsigned int i=0; i < q_dot.size(); i++) {
-      q_dot_.push_back(q_dot[i]);
+    std::vector<double> q_dot_(6, 0.);
+    for (unsigned int i=0; i < 6; i++) {
+      for (unsigned int j=0; j < 6; j++) {
+        q_dot_[i] += cJe_inv(i, j) * v[j];
+      }
     }
 
     adapter->setJointVel(q_dot_);
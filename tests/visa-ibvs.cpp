@@ -49,6 +49,9 @@
 */
 
 #include "vpVisaAdapter.h"
+#include "vpVisaPeriodic.h"
+#include "vpVisaReplay.h"
+#include "vpVisaTrackingStage.h"
 
 
 #include <visp3/core/vpConfig.h>
@@ -150,20 +153,74 @@ void compute_pose(vpPoint point[], vpDot2 dot[], int ndot, vpCameraParameters ca
   cro.buildFrom(cRo);
 }
 
-int main()
+int main(int argc, char **argv)
 {
+  // --grabber: images are acquired by the adapter in a background thread
+  // --roi: only the windows around the dots are transferred while tracking
+  // --stats: prints the adapter latency per phase every 5 s, and the loop
+  //   timing at the end
+  // --record file: session log of the run, the clicked dots in file.dots
+  // --replay file: runs offline on a recorded session, without display nor
+  //   pacing, and compares the velocities with the recorded ones
+  // --local-kinematics: fMe and eJe computed from q with the Viper 650 model
+  // --realtime priority: the servo loop in SCHED_FIFO, where permitted
+  // --threads N: the dots tracked on N threads, 1 (sequential) by default
+  //   until a gain is measured on the host
+  bool useGrabber = false, useRoi = false, printStats = false, localKinematics = false;
+  int realtimePriority = 0, trackingThreads = 1;
+  std::string recordFile, replayFile;
+  for (int a = 1; a < argc; a++) {
+    if (std::string(argv[a]) == "--grabber")
+      useGrabber = true;
+    else if (std::string(argv[a]) == "--roi")
+      useRoi = true;
+    else if (std::string(argv[a]) == "--stats")
+      printStats = true;
+    else if (std::string(argv[a]) == "--local-kinematics")
+      localKinematics = true;
+    else if (std::string(argv[a]) == "--record" && a + 1 < argc)
+      recordFile = argv[++a];
+    else if (std::string(argv[a]) == "--replay" && a + 1 < argc)
+      replayFile = argv[++a];
+    else if (std::string(argv[a]) == "--realtime" && a + 1 < argc)
+      realtimePriority = atoi(argv[++a]);
+    else if (std::string(argv[a]) == "--threads" && a + 1 < argc)
+      trackingThreads = std::max(1, atoi(argv[++a]));
+  }
+  bool replaying = !replayFile.empty();
+
   try {
     vpHomogeneousMatrix eMc(vpTranslationVector(0, 0, 0), vpRotationMatrix(vpRxyzVector(0, 0, -M_PI/2.)));
     vpVelocityTwistMatrix cVe(eMc.inverse());
 
     vpServo task;
   
-    // init communication with simulator
-    vpVisaAdapter * adapter = new vpVisaAdapter();
-    adapter->connect();
+    // init communication with simulator, or the recorded session
+    vpVisaAdapter * adapter = NULL;
+    vpVisaReplay * replay = NULL;
+    vpVisaBackend * robot;
+    if (replaying) {
+      replay = new vpVisaReplay();
+      if (!replay->open(replayFile)) {
+        delete replay;
+        return EXIT_FAILURE;
+      }
+      robot = replay;
+      useGrabber = false;
+    } else {
+      adapter = new vpVisaAdapter();
+      adapter->connect();
+      if (printStats)
+        adapter->setStatsDump(5000);
+      if (localKinematics)
+        adapter->setKinematicModel(std::make_shared<vpVisaViSPModel<vpViper650> >());
+      if (!recordFile.empty() && !adapter->startRecording(recordFile))
+        std::cout << "Cannot record to " << recordFile << std::endl;
+      robot = adapter;
+    }
 
     std::vector<double> calibMatrix;
-    adapter->getCalibMatrix(calibMatrix);
+    robot->getCalibMatrix(calibMatrix);
     double px = calibMatrix[0];
     double py = calibMatrix[4];
     double u0 = calibMatrix[6];
@@ -175,17 +232,20 @@ int main()
     vpImage<unsigned char> I(v0*2, u0*2, 0);
     int i;
 
-    I = adapter->getImageViSP();
+    robot->getImageViSP(I);
 
 //    g.acquire(I);
 
+    vpDisplay * display = NULL;
+    if (!replaying) {
 #ifdef VISP_HAVE_X11
-    vpDisplayX display(I, 100, 100, "Current image");
+      display = new vpDisplayX(I, 100, 100, "Current image");
 #elif defined(VISP_HAVE_OPENCV)
-    vpDisplayOpenCV display(I, 100, 100, "Current image");
+      display = new vpDisplayOpenCV(I, 100, 100, "Current image");
 #elif defined(VISP_HAVE_GTK)
-    vpDisplayGTK display(I, 100, 100, "Current image");
+      display = new vpDisplayGTK(I, 100, 100, "Current image");
 #endif
+    }
 
     vpDisplay::display(I);
     vpDisplay::flush(I);
@@ -193,15 +253,34 @@ int main()
     vpDot2 dot[4];
     vpImagePoint cog;
 
-    std::cout << "Click on the 4 dots clockwise starting from upper/left dot..." << std::endl;
+    if (replaying) {
+      // where they were clicked when recording
+      std::ifstream dots(replayFile + ".dots");
+      for (i = 0; i < 4; i++) {
+        double u = 0, v = 0;
+        dots >> u >> v;
+        dot[i].initTracking(I, vpImagePoint(v, u));
+      }
+    } else {
+      std::cout << "Click on the 4 dots clockwise starting from upper/left dot..." << std::endl;
 
-    for (i = 0; i < 4; i++) {
-      dot[i].setGraphics(true);
-      dot[i].initTracking(I);
-      cog = dot[i].getCog();
-      vpDisplay::displayCross(I, cog, 10, vpColor::blue);
-      vpDisplay::flush(I);
+      std::ofstream dots;
+      if (adapter->isRecording())
+        dots.open(recordFile + ".dots");
+      for (i = 0; i < 4; i++) {
+        dot[i].setGraphics(true);
+        dot[i].initTracking(I);
+        cog = dot[i].getCog();
+        dots << cog.get_u() << " " << cog.get_v() << std::endl;
+        vpDisplay::displayCross(I, cog, 10, vpColor::blue);
+        vpDisplay::flush(I);
+        // tracked from several threads, which must not draw
+        if (trackingThreads > 1)
+          dot[i].setGraphics(false);
+      }
     }
+    // no worker thread: tracked in turn on this one
+    vpVisaTrackingStage<vpDot2> tracking(trackingThreads - 1);
 
     vpCameraParameters cam;
     cam.initPersProjWithoutDistortion(px, py, u0, v0);
@@ -216,6 +295,12 @@ int main()
     std::cout << cam << std::endl;
     }
 
+    if (useGrabber && !adapter->startGrabber()) {
+      std::cout << "Cannot start the frame grabber, images are acquired in the loop" << std::endl;
+      useGrabber = false;
+    }
+    vpVisaFrameInfo frameInfo;
+
     // Sets the current position of the visual feature
     vpFeaturePoint p[4];
     for (i = 0; i < 4; i++)
@@ -271,31 +356,50 @@ int main()
 
     // Set the Jacobian (expressed in the end-effector frame)
     vpMatrix eJe;
+    vpVisaRobotState state;
     bool quit = false;
 
     std::cout << "\nHit CTRL-C to stop the loop...\n" << std::flush;
+    double start = vpTime::measureTimeMs();
+    unsigned int iterations = 0;
+    // Loop time is set to 40 ms, ie 25 Hz, on absolute deadlines
+    vpVisaPeriodic loop(40000);
+    loop.setRealtime(realtimePriority);
+    if (!replaying)
+      loop.begin();
     while (! quit) {
-      double t = vpTime::measureTimeMs();
-
       // Acquire a new image from the camera
-      I = adapter->getImageViSP();
+      if (replaying && replay->isFinished())
+        break;
+      if (useGrabber)
+        adapter->getLatestImageViSP(I, frameInfo);
+      else if (useRoi) {
+        // each dot may move by its own size before the next image
+        std::vector<vpRect> windows;
+        for (i = 0; i < 4; i++) {
+          vpRect bbox = dot[i].getBBox();
+          windows.push_back(vpRect(bbox.getLeft() - bbox.getWidth(), bbox.getTop() - bbox.getHeight(),
+                                   3 * bbox.getWidth(), 3 * bbox.getHeight()));
+        }
+        robot->getImageROI(I, windows);
+      }
+      else
+        robot->getImageViSP(I);
+      iterations++;
 
       // Display this image
       vpDisplay::display(I);
 
-      try {
-        // For each point...
+      // Achieve the tracking of the dots in the image
+      if (tracking.track(I, dot, 4)) {
+        // Display a green cross at the center of gravity position in the
+        // image
         for (i = 0; i < 4; i++) {
-          // Achieve the tracking of the dot in the image
-          dot[i].track(I);
-          // Display a green cross at the center of gravity position in the
-          // image
           cog = dot[i].getCog();
           vpDisplay::displayCross(I, cog, 10, vpColor::green);
         }
-      } catch (...) {
+      } else
         quit = true;
-      }
 
       // During the servo, we compute the pose using LOWE method. For the
       // initial pose used in the non linear minimisation we use the pose
@@ -314,11 +418,10 @@ int main()
         p[i].set_Z(cP[2]);
       }
 
-      // Get the jacobian of the robot
-      std::vector<double> qvec;
-      adapter->getJointPos(qvec);
-      vpColVector q(qvec);
-      eJe = adapter->get_eJe();
+      // Get the joint positions and the jacobian of the robot in one round trip
+      robot->tick({}, VISA_STATE_ALL, state);
+      vpColVector q(state.jointPos);
+      eJe = vpVisaBackend::get_eJe(state);
 
       // Update this jacobian in the task structure. It will be used to
       // compute the velocity skew (as an articular velocity) qdot = -lambda *
@@ -342,7 +445,7 @@ int main()
       v.rad2deg();
       std::cout << "Send qdot in deg: " << v.t() << std::endl;
 
-      adapter->setJointVel(v_);
+      robot->setJointVel(v_);
 
       // Display the current and desired feature points in the image display
       vpServoDisplay::display(task, cam, I);
@@ -360,15 +463,41 @@ int main()
 
       // std::cout << "|| s - s* || = "  << ( task.getError() ).sumSquare() <<
       // std::endl;
-      vpTime::wait(t, 40); // Loop time is set to 40 ms, ie 25 Hz
+      if (!replaying)
+        loop.wait();
+    }
+    if (!replaying) {
+      loop.end();
+      if (printStats) {
+        loop.printStats(std::cout);
+        for (i = 0; i < 4; i++) {
+          vpVisaLatency timing = tracking.getTiming(i);
+          std::cout << "Dot " << i << " tracking (us): mean " << timing.mean << ", p99 " << timing.p99 << std::endl;
+        }
+      }
+    }
+
+    robot->setJointVel({0,0,0,0,0,0,0}); // stop robot
+
+    if (replaying) {
+      double elapsed = vpTime::measureTimeMs() - start;
+      std::cout << "Replayed " << iterations << " iterations in " << elapsed << " ms ("
+                << elapsed / std::max(1u, iterations) << " ms each), largest velocity deviation: "
+                << replay->getMaxCommandDeviation() << ", unmatched commands: "
+                << replay->getUnmatchedCommands() << std::endl;
     }
 
-    adapter->setJointVel({0,0,0,0,0,0,0}); // stop robot
+    if (useGrabber) {
+      std::cout << "Grabbed frames: " << frameInfo.sequence << ", dropped: " << adapter->getDroppedFrames()
+                << ", duplicated: " << adapter->getDuplicatedFrames() << std::endl;
+      adapter->stopGrabber();
+    }
 
     std::cout << "Display task information: " << std::endl;
     task.print();
     task.kill();
-    delete adapter;
+    delete display;
+    delete robot;
     return EXIT_SUCCESS;
   }
   catch (const vpException &e) {
@@ -2,6 +2,7 @@
 #include <chrono>
 #include <thread>
 #include "vpVisaAdapter.h"
+#include "vpVisaPeriodic.h"
 
 #include <visp3/gui/vpDisplayOpenCV.h>
 #include <visp3/blob/vpDot2.h>
@@ -18,9 +19,10 @@ int main ()
     vpVisaAdapter adapter;
     adapter.connect();
 
+    // 25 Hz, on absolute deadlines
+    vpVisaPeriodic loop(40000);
+    loop.begin();
     while(1){
-        double t = vpTime::measureTimeMs();
-
         auto fJe = adapter.get_fJe(); //geometric jacobian
         auto eJe = adapter.get_eJe(); //analytical jacobian
         auto fMe = adapter.get_fMe();
@@ -50,6 +52,6 @@ int main ()
 
         adapter.setJointVel(qdotVec);
 
-        vpTime::wait(t, 40);
+        loop.wait();
     }    
 }
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "vpVisaAdapter.h"
+#include "vpVisaSimStub.h"
+
+// Round trip time of the numeric queries and commands with the text and the
+// binary protocol, against an in-process stand-in server.
+
+static const unsigned int port = 2418;
+static const int iterations = 5000;
+
+template <typename F>
+static void measure(const char * name, F call)
+{
+    std::vector<double> durations(iterations);
+
+    // the text protocol prints every command, keep that cost but not the output
+    std::ostringstream sink;
+    std::streambuf * console = std::cout.rdbuf(sink.rdbuf());
+    for (int i = 0; i < iterations; i++){
+        auto start = std::chrono::steady_clock::now();
+        call();
+        durations[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        if (sink.tellp() > (1 << 20)) sink.str("");
+    }
+    std::cout.rdbuf(console);
+
+    std::sort(durations.begin(), durations.end());
+    double mean = 0;
+    for (auto d : durations) mean += d / iterations;
+    std::cout << "  " << std::left << std::setw(18) << name << std::right << std::fixed << std::setprecision(1)
+              << " mean " << std::setw(7) << mean << " us"
+              << "   p50 " << std::setw(7) << durations[iterations / 2] << " us"
+              << "   p99 " << std::setw(7) << durations[iterations * 99 / 100] << " us" << std::endl;
+}
+
+int main()
+{
+    vpVisaSimStub stub;
+    if (!stub.start("127.0.0.1", port)) return EXIT_FAILURE;
+
+    vpVisaAdapter adapter;
+    adapter.connect("127.0.0.1", port);
+
+    for (int mode = 0; mode < 2; mode++){
+        if (mode == 1 && !adapter.setBinaryProtocol(true)) return EXIT_FAILURE;
+        std::cout << (mode == 0 ? "text protocol" : "binary protocol") << std::endl;
+
+        std::vector<double> values;
+        std::vector<double> velocities(6, 0.0);
+        measure("getJointPos", [&](){ adapter.getJointPos(values); });
+        measure("getToolTransform", [&](){ adapter.getToolTransform(values); });
+        measure("getCalibMatrix", [&](){ adapter.getCalibMatrix(values); });
+        measure("setJointVel", [&](){ adapter.setJointVel(velocities); });
+
+        // the robot is still: compare with the exact joint positions
+        adapter.getJointPos(values);
+        std::vector<double> q = stub.getJointPos();
+        double error = 0;
+        for (size_t i = 0; i < q.size() && i < values.size(); i++) error = std::max(error, std::fabs(values[i] - q[i]));
+        std::cout << "  max joint position error " << std::scientific << std::setprecision(2) << error << std::endl;
+    }
+
+    adapter.disconnect();
+    stub.stop();
+    return EXIT_SUCCESS;
+}
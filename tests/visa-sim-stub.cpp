@@ -0,0 +1,65 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "vpVisaSimStub.h"
+
+// Stand-in for the VISA simulator, by default listening on 127.0.0.1:2408
+// with synthetic 640x480 JPEG frames and no added latency.
+
+static void usage(const char * name)
+{
+    std::cerr << "usage: " << name << " [options] [recorded frames (.jpg/.png) ...]\n"
+              << "  --host <ip>          listening address (127.0.0.1)\n"
+              << "  --port <port>        listening port (2408)\n"
+              << "  --size <w>x<h>       synthetic image size (640x480)\n"
+              << "  --codec jpeg|png     synthetic image codec (jpeg)\n"
+              << "  --quality <1-100>    jpeg quality (90)\n"
+              << "  --latency <ms>       delay added to every reply (0)\n"
+              << "  --chunk <bytes>      image payload datagram size (60000)\n"
+              << "  --drop <rate>        fraction of the reply datagrams lost (0)" << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+    std::string host = "127.0.0.1";
+    unsigned int port = 2408;
+    std::vector<std::string> files;
+    vpVisaSimStub stub;
+
+    for (int i = 1; i < argc; i++){
+        std::string option(argv[i]);
+        bool hasValue = (i + 1 < argc);
+        if (option.compare(0, 2, "--") != 0){
+            files.push_back(option);
+        }
+        else if (!hasValue){
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        else{
+            std::string value(argv[++i]);
+            if (option == "--host") host = value;
+            else if (option == "--port") port = atoi(value.c_str());
+            else if (option == "--quality") stub.setJpegQuality(atoi(value.c_str()));
+            else if (option == "--latency") stub.setLatency(atof(value.c_str()));
+            else if (option == "--chunk") stub.setChunkSize(atoi(value.c_str()));
+            else if (option == "--drop") stub.setDropRate(atof(value.c_str()));
+            else if (option == "--codec" && (value == "jpeg" || value == "png")){
+                stub.setCodec(value == "png" ? vpVisaSimStub::PNG : vpVisaSimStub::JPEG);
+            }
+            else if (option == "--size" && value.find('x') != std::string::npos){
+                stub.setImageSize(atoi(value.c_str()), atoi(value.c_str() + value.find('x') + 1));
+            }
+            else{
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (!files.empty() && !stub.loadFrames(files)) return EXIT_FAILURE;
+
+    std::cout << "VISA stand-in listening on " << host << ":" << port << std::endl;
+    return stub.run(host.c_str(), port) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,652 @@
+#include "vpVisaSimStub.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <string.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <cpp-base64/base64.h>
+
+#include "vpVisaProtocol.h"
+
+#ifdef WITH_VISP
+#include <visp3/robot/vpViper650.h>
+#endif
+
+#ifdef WITH_JPEG
+#include <jpeglib.h>
+#endif
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+// =============================================================================
+// IMAGE ENCODING
+// =============================================================================
+
+#ifdef WITH_JPEG
+static std::vector<unsigned char> encodeJpeg(const std::vector<unsigned char> & rgb, unsigned int width,
+                                             unsigned int height, int quality)
+{
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    unsigned char * buffer = NULL;
+    unsigned long size = 0;
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height){
+        JSAMPROW row = (JSAMPROW)&rgb[(size_t)cinfo.next_scanline * width * 3];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+
+    std::vector<unsigned char> jpeg(buffer, buffer + size);
+    free(buffer);
+    jpeg_destroy_compress(&cinfo);
+    return jpeg;
+}
+#endif
+
+static unsigned int crc32Png(const unsigned char * data, size_t size, unsigned int crc = 0)
+{
+    static unsigned int table[256] = {0};
+    if (table[1] == 0){
+        for (unsigned int n = 0; n < 256; n++){
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void appendBigEndian(std::vector<unsigned char> & out, unsigned int value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back((unsigned char)(value >> shift));
+}
+
+static void appendChunk(std::vector<unsigned char> & png, const char * type, const std::vector<unsigned char> & data)
+{
+    appendBigEndian(png, data.size());
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    appendBigEndian(png, crc32Png(&png[start], png.size() - start));
+}
+
+// 8 bit RGB png, zlib compressed when available, stored blocks otherwise
+static std::vector<unsigned char> encodePng(const std::vector<unsigned char> & rgb, unsigned int width,
+                                            unsigned int height)
+{
+    std::vector<unsigned char> raw;
+    raw.reserve((size_t)(width * 3 + 1) * height);
+    for (unsigned int y = 0; y < height; y++){
+        raw.push_back(0); // no filter
+        raw.insert(raw.end(), rgb.begin() + (size_t)y * width * 3, rgb.begin() + (size_t)(y + 1) * width * 3);
+    }
+
+    std::vector<unsigned char> idat;
+#ifdef WITH_ZLIB
+    uLongf size = compressBound(raw.size());
+    idat.resize(size);
+    compress2(idat.data(), &size, raw.data(), raw.size(), 6);
+    idat.resize(size);
+#else
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    for (size_t offset = 0; offset < raw.size(); offset += 65535){
+        unsigned int length = std::min<size_t>(65535, raw.size() - offset);
+        idat.push_back(offset + length == raw.size() ? 1 : 0);
+        idat.push_back(length & 0xFF);
+        idat.push_back(length >> 8);
+        idat.push_back(~length & 0xFF);
+        idat.push_back((~length >> 8) & 0xFF);
+        idat.insert(idat.end(), raw.begin() + offset, raw.begin() + offset + length);
+    }
+    unsigned int a = 1, b = 0;
+    for (auto v : raw){
+        a = (a + v) % 65521;
+        b = (b + a) % 65521;
+    }
+    appendBigEndian(idat, (b << 16) | a);
+#endif
+
+    const unsigned char signature[] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+    std::vector<unsigned char> png(signature, signature + sizeof(signature));
+    std::vector<unsigned char> ihdr;
+    appendBigEndian(ihdr, width);
+    appendBigEndian(ihdr, height);
+    ihdr.push_back(8); // bit depth
+    ihdr.push_back(2); // RGB
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+    appendChunk(png, "IHDR", ihdr);
+    appendChunk(png, "IDAT", idat);
+    appendChunk(png, "IEND", std::vector<unsigned char>());
+    return png;
+}
+
+// =============================================================================
+// STAND-IN SERVER
+// =============================================================================
+
+vpVisaSimStub::vpVisaSimStub()
+    : sock(-1), port(0), running(false), requests(0), frames(0), dropped(0),
+      width(640), height(480), codec(JPEG), jpegQuality(90), latency(0), chunkSize(60000), dropRate(0),
+      lastFrameId(0),
+      q({0.1234567891, -0.4567891234, 0.7890123456, 0.0123456789, 1.2345678901, -0.3456789012}),
+      qdot(6, 0.0), lastUpdate(std::chrono::steady_clock::now())
+{
+}
+
+vpVisaSimStub::~vpVisaSimStub()
+{
+    this->stop();
+}
+
+void vpVisaSimStub::setImageSize(unsigned int width, unsigned int height)
+{
+    this->width = width;
+    this->height = height;
+    syntheticKey.clear();
+}
+
+bool vpVisaSimStub::loadFrames(const std::vector<std::string> & files)
+{
+    recorded.clear();
+    for (const auto & file : files){
+        std::ifstream stream(file.c_str(), std::ios::binary);
+        if (!stream){
+            std::cerr << "ERROR: cannot open " << file << std::endl;
+            return false;
+        }
+        Frame frame;
+        bool png = file.size() > 4 && file.compare(file.size() - 4, 4, ".png") == 0;
+        frame.mime = png ? "png" : "jpeg";
+        frame.data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        recorded.push_back(frame);
+    }
+    return !recorded.empty();
+}
+
+bool vpVisaSimStub::bindSocket(const char * host, unsigned int port)
+{
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) return false;
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr(host);
+    address.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0){
+        std::cerr << "ERROR: cannot bind " << host << ":" << port << std::endl;
+        close(sock);
+        sock = -1;
+        return false;
+    }
+    socklen_t size = sizeof(address);
+    getsockname(sock, (struct sockaddr *)&address, &size);
+    this->port = ntohs(address.sin_port);
+    return true;
+}
+
+bool vpVisaSimStub::start(const char * host, unsigned int port)
+{
+    if (running || !this->bindSocket(host, port)) return false;
+    running = true;
+    thread = std::thread(&vpVisaSimStub::serve, this);
+    return true;
+}
+
+bool vpVisaSimStub::run(const char * host, unsigned int port)
+{
+    if (running || !this->bindSocket(host, port)) return false;
+    running = true;
+    this->serve();
+    return true;
+}
+
+void vpVisaSimStub::stop()
+{
+    running = false;
+    if (thread.joinable()) thread.join();
+    if (sock >= 0){
+        close(sock);
+        sock = -1;
+    }
+}
+
+std::vector<double> vpVisaSimStub::getJointPos()
+{
+    std::lock_guard<std::mutex> lock(stateMutex);
+    this->updateJoints();
+    return q;
+}
+
+void vpVisaSimStub::serve()
+{
+    std::vector<unsigned char> buffer(65536);
+    while (running){
+        // wake up for the next delayed reply, or regularly to check running
+        long long timeout = 100000; // us, sub-millisecond delays must not spin
+        if (!pending.empty()){
+            auto wait = std::chrono::duration_cast<std::chrono::microseconds>(
+                        pending.front().due - std::chrono::steady_clock::now()).count();
+            timeout = std::max<long long>(0, std::min<long long>(wait, timeout));
+        }
+
+        struct pollfd fds = { sock, POLLIN, 0 };
+        struct timespec delay = { (time_t)(timeout / 1000000), (long)(timeout % 1000000) * 1000 };
+        if (ppoll(&fds, 1, &delay, NULL) > 0){
+            Reply reply;
+            socklen_t length = sizeof(reply.client);
+            auto n = recvfrom(sock, (char *)buffer.data(), buffer.size() - 1, 0,
+                              (struct sockaddr *)&reply.client, &length);
+            if (n > 0){
+                requests++;
+                reply.due = std::chrono::steady_clock::now() + latency;
+                if (vpVisaProtocol::isBinary(buffer.data(), n)){
+                    this->handleBinary(buffer.data(), n, reply);
+                }
+                else{
+                    buffer[n] = '\0';
+                    this->handleText((const char *)buffer.data(), n, reply);
+                }
+                if (!reply.datagrams.empty()) pending.push_back(reply);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        while (!pending.empty() && pending.front().due <= now){
+            const Reply & reply = pending.front();
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            for (const auto & datagram : reply.datagrams){
+                if (dropRate > 0 && uniform(random) < dropRate){
+                    dropped++;
+                    continue;
+                }
+                sendto(sock, (const char *)datagram.data(), datagram.size(), 0,
+                       (const struct sockaddr *)&reply.client, sizeof(reply.client));
+            }
+            pending.pop_front();
+        }
+    }
+}
+
+void vpVisaSimStub::addPayload(Reply & reply, const unsigned char * data, unsigned int size)
+{
+    // "PACKAGE_LENGTH:<size>" then the payload split in datagrams
+    std::string header = "PACKAGE_LENGTH:" + std::to_string(size);
+    reply.datagrams.push_back(std::vector<unsigned char>(header.begin(), header.end()));
+    for (unsigned int offset = 0; offset < size; offset += chunkSize){
+        unsigned int length = std::min(chunkSize, size - offset);
+        reply.datagrams.push_back(std::vector<unsigned char>(data + offset, data + offset + length));
+    }
+}
+
+void vpVisaSimStub::handleText(const char * request, unsigned int size, Reply & reply)
+{
+    // "CMD,v1,v2,..."
+    std::string cmd(request, strcspn(request, ",\r\n"));
+    std::vector<double> values;
+    const char * p = request + cmd.size();
+    while (*p == ','){
+        char * end;
+        values.push_back(strtod(p + 1, &end));
+        if (end == p + 1) break;
+        p = end;
+    }
+    (void)size;
+
+    std::string text;
+    if (cmd == "GETIMAGE"){
+        const Frame & frame = this->currentFrame();
+        std::string payload = "data:image/" + frame.mime + ";base64," +
+                              base64_encode(frame.data.data(), frame.data.size());
+        this->addPayload(reply, (const unsigned char *)payload.data(), payload.size());
+        return;
+    }
+    else if (cmd == "GETIMAGEBW"){
+        std::vector<unsigned char> grey;
+        this->renderGrey(grey);
+        frames++;
+        this->addPayload(reply, grey.data(), grey.size());
+        return;
+    }
+    else if (cmd == "GETIMAGEDELTA"){
+        std::vector<unsigned char> grey;
+        this->renderGrey(grey);
+        unsigned int reference = values.empty() ? 0 : (unsigned int)values[0];
+        const unsigned char * previous = NULL;
+        for (const auto & sent : sentFrames){
+            if (sent.first == reference) previous = sent.second.data();
+        }
+
+        unsigned int frame = ++lastFrameId;
+        std::vector<unsigned char> payload(vpVisaProtocol::DELTA_HEADER_SIZE + grey.size());
+        payload.resize(vpVisaProtocol::encodeDelta(payload.data(), payload.size(), grey.data(), previous,
+                                                   width, height, frame, reference));
+        // a few frames back, for clients that lost the last one or share the server
+        sentFrames.push_back(std::make_pair(frame, std::move(grey)));
+        if (sentFrames.size() > 4) sentFrames.pop_front();
+        frames++;
+        this->addPayload(reply, payload.data(), payload.size());
+        return;
+    }
+    else if (cmd == "GETIMAGEROI"){
+        // windows (left, top, width, height) of the grey image, one after the other
+        std::vector<unsigned char> windows;
+        if (values.empty() || values.size() % 4 != 0 || !this->cropGrey(values, windows)){
+            text = "ERROR: bad GETIMAGEROI windows";
+        }
+        else{
+            frames++;
+            this->addPayload(reply, windows.data(), windows.size());
+            return;
+        }
+    }
+    else if (cmd == "SETPROTOCOL"){
+        text = (strstr(request, "BINARY") || strstr(request, "TEXT")) ? "OK" : "ERROR: unknown protocol";
+    }
+    else if (this->setValues(cmd, values)){
+        text = "OK";
+    }
+    else{
+        std::vector<double> result;
+        bool known = (cmd == "TICK") ? this->tick(values, result) : this->getValues(cmd, result);
+        if (!known){
+            text = "ERROR: unknown command " + cmd;
+        }
+        for (size_t i = 0; i < result.size(); i++){
+            char number[32];
+            snprintf(number, sizeof(number), "%.9g", result[i]);
+            if (i > 0) text += ",";
+            text += number;
+        }
+    }
+    reply.datagrams.push_back(std::vector<unsigned char>(text.begin(), text.end()));
+}
+
+void vpVisaSimStub::handleBinary(const unsigned char * request, unsigned int size, Reply & reply)
+{
+    unsigned char buffer[vpVisaProtocol::MAX_DATAGRAM];
+    unsigned int replySize = 0;
+
+    vpVisaProtocol::Header header;
+    const unsigned char * data;
+    if (vpVisaProtocol::decode(request, size, header, data)){
+        std::string cmd = vpVisaProtocol::name(header.opcode);
+        std::vector<double> values(header.count);
+        for (unsigned int i = 0; i < header.count; i++){
+            values[i] = vpVisaProtocol::readDouble(data + 8 * i);
+        }
+
+        std::vector<double> result;
+        if (this->setValues(cmd, values)){
+            replySize = vpVisaProtocol::encode(buffer, sizeof(buffer), vpVisaProtocol::OP_OK, NULL, 0, header.sequence);
+        }
+        else if (cmd == "TICK" ? this->tick(values, result) : this->getValues(cmd, result)){
+            replySize = vpVisaProtocol::encode(buffer, sizeof(buffer), vpVisaProtocol::OP_VALUES,
+                                               result.data(), result.size(), header.sequence);
+        }
+        else{
+            replySize = vpVisaProtocol::encode(buffer, sizeof(buffer), vpVisaProtocol::OP_ERROR, NULL, 0, header.sequence);
+        }
+    }
+    else{
+        replySize = vpVisaProtocol::encode(buffer, sizeof(buffer), vpVisaProtocol::OP_ERROR, NULL, 0);
+    }
+    reply.datagrams.push_back(std::vector<unsigned char>(buffer, buffer + replySize));
+}
+
+bool vpVisaSimStub::getValues(const std::string & cmd, std::vector<double> & values)
+{
+    std::lock_guard<std::mutex> lock(stateMutex);
+    this->updateJoints();
+
+    if (cmd == "GETJOINTPOS"){
+        values = q;
+    }
+    else if (cmd == "GETTOOLPOS"){
+        this->getToolPos(values);
+    }
+    else if (cmd == "GETJACOBIAN"){
+        this->getJacobian(values);
+    }
+    else if (cmd == "GETCALIBMAT"){
+        // 3x3, column major: px, py on the diagonal, principal point in the last column
+        double f = width * 0.9;
+        values = {f, 0, 0, 0, f, 0, width / 2.0, height / 2.0, 1};
+    }
+    else{
+        return false;
+    }
+    return true;
+}
+
+bool vpVisaSimStub::setValues(const std::string & cmd, const std::vector<double> & values)
+{
+    std::lock_guard<std::mutex> lock(stateMutex);
+    this->updateJoints();
+
+    if (cmd == "SETJOINTVEL"){
+        for (size_t i = 0; i < qdot.size(); i++) qdot[i] = i < values.size() ? values[i] : 0.0;
+    }
+    else if (cmd == "SETJOINTPOSABS"){
+        for (size_t i = 0; i < q.size() && i < values.size(); i++) q[i] = values[i];
+    }
+    else if (cmd == "SETJOINTPOSREL"){
+        for (size_t i = 0; i < q.size() && i < values.size(); i++) q[i] += values[i];
+    }
+    else if (cmd == "HOMING"){
+        for (size_t i = 0; i < q.size(); i++) q[i] = qdot[i] = 0.0;
+    }
+    else{
+        return false;
+    }
+    return true;
+}
+
+bool vpVisaSimStub::tick(const std::vector<double> & request, std::vector<double> & result)
+{
+    if (request.empty()) return false;
+    unsigned int mask = (unsigned int)request[0];
+
+    // command and state from the same instant
+    std::lock_guard<std::mutex> lock(stateMutex);
+    this->updateJoints();
+    if (request.size() > 1){
+        for (size_t i = 0; i < qdot.size(); i++) qdot[i] = i + 1 < request.size() ? request[i + 1] : 0.0;
+    }
+
+    result.clear();
+    for (int i = 0; i < 3; i++){
+        if (!(mask & (1u << i))) continue;
+        std::vector<double> values;
+        if (i == 0) values = q;
+        else if (i == 1) this->getToolPos(values);
+        else this->getJacobian(values);
+        result.push_back(values.size());
+        result.insert(result.end(), values.begin(), values.end());
+    }
+    return true;
+}
+
+void vpVisaSimStub::updateJoints()
+{
+    auto now = std::chrono::steady_clock::now();
+    double dt = std::chrono::duration<double>(now - lastUpdate).count();
+    lastUpdate = now;
+    for (size_t i = 0; i < q.size(); i++) q[i] += qdot[i] * dt;
+}
+
+#ifdef WITH_VISP
+void vpVisaSimStub::getToolPos(std::vector<double> & values)
+{
+    vpViper650 robot;
+    vpHomogeneousMatrix fMe;
+    robot.get_fMe(vpColVector(q), fMe);
+    values.resize(16);
+    for (int i = 0; i < 4; i++){
+        for (int j = 0; j < 4; j++){
+            values[4*j+i] = fMe[i][j];
+        }
+    }
+}
+
+void vpVisaSimStub::getJacobian(std::vector<double> & values)
+{
+    vpViper650 robot;
+    vpMatrix fJe;
+    robot.get_fJe(vpColVector(q), fJe);
+    values.resize(6 * fJe.getCols());
+    for (unsigned int i = 0; i < 6; i++){
+        for (unsigned int j = 0; j < fJe.getCols(); j++){
+            values[fJe.getCols()*i + j] = fJe[i][j];
+        }
+    }
+}
+#else
+// cartesian robot: translations along x, y, z then rotations about x, y, z
+void vpVisaSimStub::getToolPos(std::vector<double> & values)
+{
+    double cx = cos(q[3]), sx = sin(q[3]);
+    double cy = cos(q[4]), sy = sin(q[4]);
+    double cz = cos(q[5]), sz = sin(q[5]);
+    double R[3][3] = {
+        { cy*cz,              -cy*sz,              sy     },
+        { sx*sy*cz + cx*sz,   -sx*sy*sz + cx*cz,   -sx*cy },
+        { -cx*sy*cz + sx*sz,  cx*sy*sz + sx*cz,    cx*cy  }
+    };
+    values.assign(16, 0.0);
+    for (int i = 0; i < 3; i++){
+        for (int j = 0; j < 3; j++){
+            values[4*j+i] = R[i][j];
+        }
+        values[12+i] = q[i];
+    }
+    values[15] = 1.0;
+}
+
+void vpVisaSimStub::getJacobian(std::vector<double> & values)
+{
+    double cx = cos(q[3]), sx = sin(q[3]);
+    double cy = cos(q[4]), sy = sin(q[4]);
+    // rotation axes of the last three joints expressed in the base frame
+    double axes[3][3] = {
+        { 1, 0,  0      },
+        { 0, cx, sx     },
+        { sy, -sx*cy, cx*cy }
+    };
+    values.assign(36, 0.0);
+    for (int i = 0; i < 3; i++){
+        values[6*i + i] = 1.0;
+        for (int j = 0; j < 3; j++){
+            values[6*(3+i) + 3+j] = axes[j][i];
+        }
+    }
+}
+#endif
+
+// =============================================================================
+// IMAGES
+// =============================================================================
+
+void vpVisaSimStub::renderGrey(std::vector<unsigned char> & grey)
+{
+    std::vector<double> joints = this->getJointPos();
+
+    // four dots on the corners of a square that moves, scales and turns with the robot
+    double cx = width * (0.5 + 0.2 * sin(joints[0]));
+    double cy = height * (0.5 + 0.2 * sin(joints[1]));
+    double half = height / 6.0 * (1.0 + 0.3 * sin(joints[2]));
+    double angle = joints[5];
+    double radius = height / 30.0;
+
+    grey.assign((size_t)width * height, 200);
+    for (int k = 0; k < 4; k++){
+        double dx = (k == 0 || k == 3) ? -half : half;
+        double dy = (k < 2) ? -half : half;
+        double u = cx + cos(angle) * dx - sin(angle) * dy;
+        double v = cy + sin(angle) * dx + cos(angle) * dy;
+        int u0 = std::max(0, (int)(u - radius)), u1 = std::min((int)width - 1, (int)(u + radius));
+        int v0 = std::max(0, (int)(v - radius)), v1 = std::min((int)height - 1, (int)(v + radius));
+        for (int y = v0; y <= v1; y++){
+            for (int x = u0; x <= u1; x++){
+                if ((x - u) * (x - u) + (y - v) * (y - v) <= radius * radius) grey[(size_t)y * width + x] = 30;
+            }
+        }
+    }
+}
+
+bool vpVisaSimStub::cropGrey(const std::vector<double> & windows, std::vector<unsigned char> & pixels)
+{
+    std::vector<unsigned char> grey;
+    this->renderGrey(grey);
+
+    pixels.clear();
+    for (size_t i = 0; i + 3 < windows.size(); i += 4){
+        if (windows[i] < 0 || windows[i+1] < 0 || windows[i+2] < 1 || windows[i+3] < 1) return false;
+        unsigned int left = windows[i], top = windows[i+1], w = windows[i+2], h = windows[i+3];
+        if (left + w > width || top + h > height) return false;
+        for (unsigned int y = top; y < top + h; y++){
+            const unsigned char * row = &grey[(size_t)y * width + left];
+            pixels.insert(pixels.end(), row, row + w);
+        }
+    }
+    return true;
+}
+
+const vpVisaSimStub::Frame & vpVisaSimStub::currentFrame()
+{
+    unsigned long long index = frames++;
+    if (!recorded.empty()) return recorded[index % recorded.size()];
+
+    std::vector<unsigned char> grey;
+    this->renderGrey(grey);
+
+    // the encoded frame is kept as long as the scene does not change
+    std::vector<int> key(grey.size() / 4096 + 1, 0);
+    for (size_t i = 0; i < grey.size(); i++) key[i / 4096] += grey[i];
+    if (key == syntheticKey) return synthetic;
+    syntheticKey = key;
+
+    std::vector<unsigned char> rgb(grey.size() * 3);
+    for (size_t i = 0; i < grey.size(); i++) rgb[3*i] = rgb[3*i+1] = rgb[3*i+2] = grey[i];
+
+#ifdef WITH_JPEG
+    if (codec == JPEG){
+        synthetic.mime = "jpeg";
+        synthetic.data = encodeJpeg(rgb, width, height, jpegQuality);
+        return synthetic;
+    }
+#endif
+    synthetic.mime = "png";
+    synthetic.data = encodePng(rgb, width, height);
+    return synthetic;
+}
@@ -0,0 +1,122 @@
+#ifndef VISA_SIM_STUB_H
+#define VISA_SIM_STUB_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+
+#include <netinet/in.h>
+
+// Local stand-in for the VISA simulator, used to benchmark and test
+// vpVisaAdapter without the real simulator. It implements the commands used
+// by the adapter, in text and in binary (vpVisaProtocol) on the same UDP
+// socket.
+//
+// The robot is a 6 DOF arm driven by the joint velocities it receives. With
+// ViSP its geometry is the Viper 650 one, otherwise a simple cartesian robot
+// (one translation or rotation per joint).
+//
+// Images are either synthetic (four dark dots on a light background, moving
+// with the robot) or recorded JPEG/PNG files served in a loop. Every reply is
+// delayed by the configured latency without blocking the other requests.
+class vpVisaSimStub
+{
+    public:
+        enum Codec { JPEG, PNG };
+
+        vpVisaSimStub();
+        ~vpVisaSimStub();
+
+        // configuration, before start()/run()
+        void setImageSize(unsigned int width, unsigned int height);
+        void setCodec(Codec codec){ this->codec = codec; }
+        void setJpegQuality(int quality){ jpegQuality = quality; }
+        void setLatency(double ms){ latency = std::chrono::microseconds((long long)(ms * 1000)); }
+        void setChunkSize(unsigned int bytes){ chunkSize = bytes; }
+        // fraction of the reply datagrams lost on purpose
+        void setDropRate(double rate){ dropRate = rate; }
+        // recorded frames (.jpg or .png) replace the synthetic ones
+        bool loadFrames(const std::vector<std::string> & files);
+
+        // binds the socket and serves in a background thread. Port 0 binds
+        // any free port, see getPort().
+        bool start(const char * host = "127.0.0.1", unsigned int port = 2408);
+        // binds the socket and serves in the calling thread until stop()
+        bool run(const char * host = "127.0.0.1", unsigned int port = 2408);
+        void stop();
+
+        // port the socket is bound to, 0 before start()/run()
+        unsigned int getPort() const { return port; }
+        std::vector<double> getJointPos();
+        unsigned long long getRequestCount() const { return requests; }
+        unsigned long long getFrameCount() const { return frames; }
+        unsigned long long getDroppedCount() const { return dropped; }
+
+    private:
+        struct Reply
+        {
+            std::chrono::steady_clock::time_point due;
+            sockaddr_in client;
+            std::vector<std::vector<unsigned char> > datagrams;
+        };
+        struct Frame
+        {
+            std::string mime; // "jpeg" or "png"
+            std::vector<unsigned char> data;
+        };
+
+        bool bindSocket(const char * host, unsigned int port);
+        void serve();
+        void handleText(const char * request, unsigned int size, Reply & reply);
+        void handleBinary(const unsigned char * request, unsigned int size, Reply & reply);
+        // fills values for a numeric query, false for an unknown command
+        bool getValues(const std::string & cmd, std::vector<double> & values);
+        bool setValues(const std::string & cmd, const std::vector<double> & values);
+        // TICK: mask and joint velocities in, requested state out
+        bool tick(const std::vector<double> & request, std::vector<double> & result);
+        void updateJoints();
+        void getToolPos(std::vector<double> & fMe);   // 4x4, column major
+        void getJacobian(std::vector<double> & fJe);  // 6xN, row major
+
+        // images
+        void addPayload(Reply & reply, const unsigned char * data, unsigned int size);
+        void renderGrey(std::vector<unsigned char> & grey);
+        // GETIMAGEROI: (left, top, width, height) windows of the grey image, false if one is outside
+        bool cropGrey(const std::vector<double> & windows, std::vector<unsigned char> & pixels);
+        const Frame & currentFrame();
+
+        int sock;
+        unsigned int port;
+        std::thread thread;
+        std::atomic<bool> running;
+        std::atomic<unsigned long long> requests;
+        std::atomic<unsigned long long> frames;
+        std::atomic<unsigned long long> dropped;
+        std::deque<Reply> pending; // ordered by due time (constant latency)
+
+        unsigned int width;
+        unsigned int height;
+        Codec codec;
+        int jpegQuality;
+        std::chrono::microseconds latency;
+        unsigned int chunkSize;
+        double dropRate;
+        std::mt19937 random;
+        std::vector<Frame> recorded;
+        Frame synthetic;
+        std::vector<int> syntheticKey; // dot positions of the cached synthetic frame
+        std::deque<std::pair<unsigned int, std::vector<unsigned char> > > sentFrames; // GETIMAGEDELTA references
+        unsigned int lastFrameId;
+
+        std::mutex stateMutex;
+        std::vector<double> q;
+        std::vector<double> qdot;
+        std::chrono::steady_clock::time_point lastUpdate;
+};
+
+#endif // VISA_SIM_STUB_H